@@ -12,6 +12,27 @@
 namespace linuxdeploy {
     namespace core {
         namespace appdir {
+            // how files are put into the AppDir
+            enum LinkMode {
+                // copy the data (default)
+                LINK_MODE_COPY = 0,
+
+                // share the data with the source file (copy-on-write, e.g., on btrfs or XFS), fall back to copying
+                LINK_MODE_REFLINK,
+
+                // create hardlinks to the source files, fall back to copying
+                LINK_MODE_HARDLINK,
+
+                // try reflinks first, then hardlinks, then fall back to copying
+                LINK_MODE_AUTO,
+            };
+
+            // how files with identical contents are replaced by deduplicateFiles()
+            enum DeduplicationMode {
+                DEDUPLICATE_WITH_HARDLINKS = 0,
+                DEDUPLICATE_WITH_SYMLINKS,
+            };
+
             /*
              * Base class for AppDirs.
              */
@@ -40,6 +61,8 @@ namespace linuxdeploy {
                     //
                     // if destination is specified, the library is copied to this location, and the rpath is adjusted accordingly
                     // the dependencies are copied to the normal destination, though
+                    // files which are reached via multiple paths (e.g., soname symlinks) are copied once only, the other
+                    // paths become symlinks to the copy if they'd be copied into the same directory
                     bool deployLibrary(const boost::filesystem::path& path, const boost::filesystem::path& destination = "");
 
                     // force deploy shared library
@@ -58,6 +81,17 @@ namespace linuxdeploy {
                     // deploy icon
                     bool deployIcon(const boost::filesystem::path& path);
 
+                    // create symlink to target, replacing existing files atomically
+                    // if symlink is an existing directory, the link is created in this directory
+                    // with useRelativePath, the link points to the target relative to the link's directory (like
+                    // ln -s --relative), otherwise it points to the absolute path of the target
+                    bool createSymlink(const boost::filesystem::path& target, const boost::filesystem::path& symlink, bool useRelativePath = true);
+
+                    // create multiple symlinks, see createSymlink()
+                    // each pair consists of the target and the symlink
+                    // all links are attempted; returns false if any of them could not be created
+                    bool createSymlinks(const std::vector<std::pair<boost::filesystem::path, boost::filesystem::path>>& links, bool useRelativePath = true);
+
                     // deploy arbitrary file
                     void deployFile(const boost::filesystem::path& from, const boost::filesystem::path& to);
 
@@ -85,6 +119,53 @@ namespace linuxdeploy {
                     // resources' filenames should be prefixed with this value (example: linuxdeploy_48x48.png)
                     void setAppName(const std::string& appName);
 
+                    // set the number of threads used to process the deployed files in parallel
+                    // by default (or if set to 0), one thread per CPU core is used
+                    // while the files are copied and processed, the threads are split between copying and processing
+                    // (at least one thread each)
+                    void setJobs(size_t jobs);
+
+                    // set how files are put into the AppDir
+                    // files which are modified during the deployment (e.g., stripped ELF files, or ones whose rpath is
+                    // set) are never hardlinked, as that would modify the source files, too
+                    void setLinkMode(LinkMode linkMode);
+
+                    // enable incremental deployment
+                    // a manifest stored in the AppDir records how the deployed files have been created, so that files
+                    // which are up to date can be skipped when deploying to the same AppDir again, while files whose
+                    // source files have changed are replaced
+                    void setIncremental(bool incremental);
+
+                    // resume an interrupted run, which must be called with the same arguments
+                    // while the deferred operations are executed, a journal in the AppDir records their progress, which
+                    // is removed once they have completed; when resuming, the operations which have been completed
+                    // according to the journal are skipped, and files which might have been written partially are
+                    // replaced
+                    void setResume(bool resume);
+
+                    // enable the persistent cache for information about deployed files (e.g., their dependencies), which
+                    // speeds up subsequent runs
+                    // pass an empty path to disable the cache again
+                    void setCacheDirectory(const boost::filesystem::path& path);
+
+                    // set the directory containing the dpkg database, which is used to look up the copyright files of
+                    // the deployed files
+                    // defaults to $DPKG_ADMINDIR, or /var/lib/dpkg if that is not set
+                    void setPackageDatabaseDirectory(const boost::filesystem::path& path);
+
+                    // exclude libraries whose filenames match the given name or shell wildcard pattern from deployment,
+                    // in addition to the ones on the excludelist
+                    // like the excludelist, this doesn't apply to libraries deployed with forceDeployLibrary()
+                    void addExcludedLibraryPattern(const std::string& pattern);
+
+                    // replace files with identical contents (and permissions) in the AppDir with hardlinks or relative
+                    // symlinks to one of them
+                    // symlinks are only created within a directory, duplicates in other directories are hardlinked, as
+                    // executables would resolve $ORIGIN relative to the directory of the symlink target
+                    // this should be the last step of the deployment, as modifying a hardlinked file modifies all the
+                    // files linked to it
+                    bool deduplicateFiles(DeduplicationMode mode);
+
                     // list all executables in <AppDir>/usr/bin
                     // this function does not perform a recursive search, but only searches the bin directory
                     std::vector<boost::filesystem::path> listExecutables();
@@ -93,6 +174,10 @@ namespace linuxdeploy {
                     // this function recursively searches the entire lib directory for shared libraries
                     std::vector<boost::filesystem::path> listSharedLibraries();
 
+                    // resolve the dependencies of the given ELF files (and their dependencies) in parallel
+                    // calling this before deploying many files speeds up the deployment, the result is the same
+                    void resolveDependencies(const std::vector<boost::filesystem::path>& paths);
+
                     // search for executables and libraries and deploy their dependencies
                     // calling this function can turn sure file trees created by make install commands into working
                     // AppDirs
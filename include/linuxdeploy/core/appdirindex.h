@@ -0,0 +1,81 @@
+// system includes
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+// local includes
+#include "linuxdeploy/core/elf.h"
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirindex {
+            // kinds of files tracked by the index, determined by their location in the AppDir
+            enum FileKind {
+                // files in usr/bin
+                FILE_KIND_EXECUTABLE = 0,
+
+                // files in usr/lib and its subdirectories
+                FILE_KIND_SHARED_LIBRARY,
+
+                // files in usr/share/icons and its subdirectories, and in usr/share/pixmaps
+                FILE_KIND_ICON,
+
+                // *.desktop files in usr/share/applications
+                FILE_KIND_DESKTOP_FILE,
+            };
+
+            /*
+             * Index of the files in an AppDir.
+             *
+             * The directories the files of interest are located in are walked once, and the regular files (and symlinks
+             * to regular files) found are classified and indexed by their names. Files added by linuxdeploy are added
+             * to the index as well. The modification times of the indexed directories are recorded, so that the index
+             * is built again if the AppDir has been changed by others (e.g., plugins).
+             *
+             * The files are returned in the order they have been found, like when iterating the directories.
+             *
+             * Not thread safe.
+             */
+            class AppDirIndex {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    explicit AppDirIndex(const boost::filesystem::path& appDirPath);
+                    ~AppDirIndex();
+
+                    AppDirIndex(const AppDirIndex&) = delete;
+                    AppDirIndex& operator=(const AppDirIndex&) = delete;
+
+                public:
+                    // list all files of the given kind
+                    std::vector<boost::filesystem::path> files(FileKind kind);
+
+                    // look up files of the given kind by their filename
+                    // with matchStem, files whose filename without the extension matches are returned, too
+                    std::vector<boost::filesystem::path> findByFilename(FileKind kind, const std::string& filename, bool matchStem = false);
+
+                    // determine the ELF file type of the file (see elf::ElfFile::probeFileType())
+                    // the result is cached until the file is replaced
+                    elf::ElfFileType elfFileType(const boost::filesystem::path& path);
+
+                    // add file which has been created or replaced
+                    // files outside the indexed directories are ignored
+                    void addFile(const boost::filesystem::path& path);
+
+                    // build the index again on the next lookup
+                    void invalidate();
+            };
+
+            // list the regular files (and symlinks to regular files) in a directory
+            // symlinks to directories are not followed when searching recursively
+            std::vector<boost::filesystem::path> listRegularFiles(const boost::filesystem::path& directory, bool recursive);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+// system includes
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirjournal {
+            /*
+             * Write-ahead journal of the deferred operations executed on an AppDir.
+             *
+             * Before files are copied or ELF files are processed (i.e., stripped and/or their rpath is set), the planned
+             * operations are written to the journal, and every operation's completion is recorded along with the
+             * identity (device, inode, size and modification time) of the resulting file. The journal is removed once
+             * all operations have completed successfully.
+             *
+             * If a run is interrupted, the journal it left behind tells which files may have been written partially,
+             * and which operations don't have to be repeated when resuming the run. An operation is only considered
+             * complete if the resulting file hasn't changed since.
+             *
+             * The records are written immediately, so they survive the process being killed. The planned copy operations
+             * are flushed to disk before the files are copied, so that files which might have been written partially are
+             * known even after a system crash.
+             *
+             * All methods are thread safe.
+             */
+            class AppDirJournal {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    explicit AppDirJournal(const boost::filesystem::path& appDirPath);
+                    ~AppDirJournal();
+
+                    // path of the journal file within the AppDir
+                    static boost::filesystem::path getJournalPath(const boost::filesystem::path& appDirPath);
+
+                public:
+                    // check whether an interrupted run has left a journal behind
+                    bool exists() const;
+
+                    // read the journal of the interrupted run, so that its completed operations can be looked up
+                    // returns false if there is no journal, or it cannot be read
+                    bool loadPreviousRun();
+
+                    // remove the temporary files the interrupted run has left behind next to the files it was writing
+                    // (i.e., files named <file>.linuxdeploy-*)
+                    // returns the number of files removed
+                    size_t removeTemporaryFiles();
+
+                    // start a new journal, replacing the existing one
+                    // returns false if the journal cannot be created, in which case nothing is recorded
+                    bool begin();
+
+                    // flush the records written so far to disk
+                    void sync();
+
+                    // finish the journal after all operations have completed, which removes it
+                    void finish();
+
+                public:
+                    // record that file is going to be copied to path
+                    void planCopy(const boost::filesystem::path& path, const boost::filesystem::path& sourcePath);
+
+                    // record that copying file to path has completed
+                    void copyCompleted(const boost::filesystem::path& path);
+
+                    // record that the ELF file is going to be processed using the given transformations
+                    void planElfProcessing(const boost::filesystem::path& path, bool strip, bool setRPath, const std::string& rpath);
+
+                    // record that processing the ELF file has completed
+                    void elfProcessingCompleted(const boost::filesystem::path& path);
+
+                public:
+                    // check whether the interrupted run had planned to copy a file to path
+                    bool wasCopyPlanned(const boost::filesystem::path& path);
+
+                    // check whether the interrupted run has copied the file from sourcePath to path, and neither of them
+                    // have changed since
+                    bool wasCopyCompleted(const boost::filesystem::path& path, const boost::filesystem::path& sourcePath);
+
+                    // check whether the interrupted run has processed the ELF file using the given transformations, and the
+                    // file hasn't changed since
+                    bool wasElfProcessingCompleted(const boost::filesystem::path& path, bool strip, bool setRPath, const std::string& rpath);
+            };
+        }
+    }
+}
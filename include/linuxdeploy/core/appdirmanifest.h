@@ -0,0 +1,69 @@
+// system includes
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirmanifest {
+            /*
+             * Records how the files in an AppDir have been created, which allows for skipping files which are up to date
+             * when linuxdeploy is run on the same AppDir again.
+             *
+             * For every file, the manifest stores the source file it has been copied from and its identity (device, inode,
+             * size and modification time), the transformations applied to it (stripping, setting the rpath), and the
+             * size, modification time and a hash of the resulting file.
+             *
+             * The manifest is stored in the AppDir's root directory.
+             *
+             * All methods are thread safe.
+             */
+            class AppDirManifest {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // read the manifest of the given AppDir, if there is one
+                    explicit AppDirManifest(const boost::filesystem::path& appDirPath);
+                    ~AppDirManifest();
+
+                    // path of the manifest file within the AppDir
+                    static boost::filesystem::path getManifestPath(const boost::filesystem::path& appDirPath);
+
+                public:
+                    // check whether file has been copied from sourcePath
+                    bool wasCopiedFrom(const boost::filesystem::path& path, const boost::filesystem::path& sourcePath);
+
+                    // check whether file has been copied from sourcePath, which hasn't changed since, using exactly the
+                    // given transformations, and the file hasn't been modified since
+                    bool isUpToDate(const boost::filesystem::path& path, const boost::filesystem::path& sourcePath,
+                                    bool strip, bool setRPath, const std::string& rpath);
+
+                    // check whether the given transformations have been applied to the file already, and the file
+                    // hasn't been modified since
+                    bool areTransformationsApplied(const boost::filesystem::path& path, bool strip, bool setRPath,
+                                                   const std::string& rpath);
+
+                    // record the current state of the file
+                    // if sourcePath is not empty, the file has just been copied from sourcePath, and the given
+                    // transformations have been applied to the copy
+                    // otherwise, the transformations have been applied to the existing file, in addition to the ones
+                    // recorded before
+                    void update(const boost::filesystem::path& path, const boost::filesystem::path& sourcePath,
+                                bool strip, bool setRPath, const std::string& rpath);
+
+                    // forget about file, e.g., because processing it failed
+                    void remove(const boost::filesystem::path& path);
+
+                    // write the manifest to the AppDir
+                    // returns true on success, false otherwise
+                    bool save();
+            };
+        }
+    }
+}
@@ -1,4 +1,6 @@
 // system includes
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -22,30 +24,122 @@ namespace linuxdeploy {
                     explicit DependencyNotFoundError(const std::string& msg) : std::runtime_error(msg) {}
             };
 
+            // describes how setRPath() updated the rpath in a file
+            enum RPathUpdateMethod {
+                // the new value fit into the space used by the old one, the file has been edited in place
+                RPATH_UPDATED_IN_PLACE = 0,
+                // the dynamic string table had to grow, patchelf had to be called
+                RPATH_UPDATED_WITH_PATCHELF,
+            };
+
+            // types of files, as determined by ElfFile::probeFileType()
+            enum ElfFileType {
+                // not an ELF file, or a corrupt one
+                ELF_FILE_TYPE_NONE = 0,
+
+                // position dependent executable
+                ELF_FILE_TYPE_EXECUTABLE,
+
+                // position independent executable
+                ELF_FILE_TYPE_PIE,
+
+                // shared library
+                ELF_FILE_TYPE_SHARED_OBJECT,
+
+                // other ELF files, e.g., object files or core dumps
+                ELF_FILE_TYPE_OTHER,
+            };
+
+            /*
+             * Lightweight view on an ELF file.
+             *
+             * Every file is mapped and parsed once per run only: all the ElfFile objects referring to the same file share
+             * the mapping and the data parsed from it, which is kept in a registry until clearRegistry() is called. If the
+             * file is modified on disk by other means than the methods in this class, it is mapped again.
+             *
+             * All methods are thread safe.
+             */
             class ElfFile {
                 private:
                     class PrivateData;
-                    PrivateData* d;
+                    std::shared_ptr<PrivateData> d;
 
                 public:
                     explicit ElfFile(const boost::filesystem::path& path);
                     ~ElfFile();
 
+                    // release the registry's references to the files which have been opened so far
+                    // the mappings are released once the last ElfFile object referring to them has been destroyed
+                    static void clearRegistry();
+
+                    // determine the type of a file by reading its ELF header and program headers
+                    // this is a lot cheaper than opening the file as an ElfFile, and doesn't throw exceptions
+                    // files which can't be opened as an ElfFile are reported as ELF_FILE_TYPE_NONE
+                    static ElfFileType probeFileType(const boost::filesystem::path& path);
+
                 public:
                     // recursively trace dynamic library dependencies of a given ELF file
                     // this works for both libraries and executables
                     // the resulting vector consists of absolute paths to the libraries determined by the same methods a system's
                     // linker would use
+                    // the file is never executed, therefore it is safe to call this method on untrusted binaries
                     std::vector<boost::filesystem::path> traceDynamicDependencies();
 
+                    // resolve the direct dependencies (i.e., the DT_NEEDED entries) of the file only, using the same rules as
+                    // traceDynamicDependencies()
+                    // loaderRPathDirectories are the DT_RPATH directories inherited from the files which loaded this file
+                    // if rpathDirectories is not null, it is set to the DT_RPATH directories the file's dependencies inherit
+                    // throws DependencyNotFoundError if a dependency cannot be found
+                    std::vector<boost::filesystem::path> resolveNeededLibraries(
+                        const std::vector<std::string>& loaderRPathDirectories = {},
+                        std::vector<std::string>* rpathDirectories = nullptr
+                    );
+
+                    // list the libraries the file directly depends on (i.e., its DT_NEEDED entries)
+                    std::vector<std::string> getNeededLibraries();
+
+                    // returns the ELF class (ELFCLASS32 or ELFCLASS64) of the file
+                    uint8_t getElfClass();
+
+                    // returns the machine (e_machine value) the file has been built for
+                    uint16_t getElfMachine();
+
                     // fetch rpath stored in binary
                     // it appears that according to the ELF standard, the rpath is ignored in libraries, therefore if the path
                     // points to an executable, an empty string is returned
                     std::string getRPath();
 
                     // set rpath in ELF file
+                    // if the new value fits into the space used by the existing rpath, the file is edited in place,
+                    // otherwise patchelf is called to make room for it
+                    // like patchelf, a DT_RPATH entry is converted to DT_RUNPATH
+                    // if method is not null, it is set to the method that was used to update the file
+                    // returns true on success, false otherwise
+                    bool setRPath(const std::string& value, RPathUpdateMethod* method = nullptr);
+
+                    // remove the symbol tables and the debug information from the ELF file
+                    // only sections which are not loaded at runtime are removed, the loaded segments are not touched
+                    // files with an unusual layout which can't be stripped safely are left unchanged
+                    // if bytesRemoved is not null, it is set to the number of bytes the file shrunk by
+                    // returns true on success, false otherwise
+                    bool strip(uint64_t* bytesRemoved = nullptr);
+
+                    // check whether strip() would leave the file unchanged, i.e., the file doesn't contain any symbol
+                    // tables or debug information which could be removed
+                    bool isStripped();
+
+                    // check whether setRPath() would leave the file unchanged, i.e., its DT_RUNPATH is set to value already
+                    bool hasRPath(const std::string& value);
+
+                    // write a copy of the file to destination in a single pass, stripped like strip() does if strip is
+                    // set, and with the rpath set to rpath if setRPath is set
+                    // the rpath can only be set if the new value fits into the space used by the existing one (see
+                    // setRPath()), otherwise the copy is written without it, and the caller has to set it on the copy
+                    // if rpathSet is not null, it is set to whether the rpath has been set
+                    // an existing file at destination is replaced, the copy gets the permissions of the file
                     // returns true on success, false otherwise
-                    bool setRPath(const std::string& value);
+                    bool writeTransformedCopy(const boost::filesystem::path& destination, bool strip, bool setRPath, const std::string& rpath,
+                                              bool* rpathSet = nullptr, uint64_t* bytesRemoved = nullptr);
             };
         }
     }
@@ -0,0 +1,51 @@
+// system includes
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace ldcache {
+            // thrown by constructor if the cache file cannot be read or is invalid
+            class LdCacheParseError : public std::runtime_error {
+                public:
+                    explicit LdCacheParseError(const std::string& msg) : std::runtime_error(msg) {}
+            };
+
+            /*
+             * Reader for the dynamic linker's cache file (usually /etc/ld.so.cache), as generated by ldconfig.
+             *
+             * Both the old (ld.so-1.7.0) and the new (glibc-ld.so.cache1.1) format are supported. The entries are
+             * loaded into a hash index, therefore looking up a library doesn't require any filesystem access.
+             */
+            class LdCache {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // parse cache file and build index
+                    explicit LdCache(const boost::filesystem::path& path = "/etc/ld.so.cache");
+                    ~LdCache();
+
+                public:
+                    // look up library by soname
+                    // only entries matching the given ELF class and machine are considered
+                    // by default, only the baseline entries are returned, not the ones optimized for specific CPU
+                    // features (hwcaps), as the libraries are supposed to run on other systems, too
+                    // returns an empty path if there is no matching entry
+                    boost::filesystem::path lookup(const std::string& soname, uint8_t elfClass, uint16_t elfMachine,
+                                                   uint64_t hwcap = 0) const;
+
+                    // number of entries in the index
+                    size_t size() const;
+            };
+        }
+    }
+}
@@ -0,0 +1,68 @@
+// system includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace libraryresolver {
+            /*
+             * Describes the ELF file on whose behalf a library is searched.
+             */
+            struct SearchContext {
+                // ELF class and machine the library must match
+                uint8_t elfClass;
+                uint16_t elfMachine;
+
+                // whether the requesting file has a DT_RUNPATH entry
+                // if it does, the DT_RPATH entries are ignored, like the dynamic linker does
+                bool hasRunPath;
+
+                // expanded directories from the DT_RPATH entries of the requesting file and the files which loaded it
+                std::vector<std::string> rpathDirectories;
+
+                // expanded directories from the DT_RUNPATH entry of the requesting file
+                std::vector<std::string> runpathDirectories;
+
+                SearchContext() : elfClass(0), elfMachine(0), hasRunPath(false) {};
+            };
+
+            /*
+             * Searches for shared libraries using the same rules as the system's dynamic linker.
+             *
+             * All information is read from the filesystem directly, no external tools are called.
+             */
+            class LibraryResolver {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // reads $LD_LIBRARY_PATH and the dynamic linker's cache (or its configuration, if the cache cannot be
+                    // read)
+                    LibraryResolver();
+                    ~LibraryResolver();
+
+                    // the configuration is read once per run, therefore there's no need to create more than one instance
+                    static LibraryResolver& getInstance();
+
+                public:
+                    // search for library in the directories the dynamic linker would search
+                    // returns an empty path if the library could not be found
+                    boost::filesystem::path findLibrary(const std::string& name, const SearchContext& context);
+
+                    // split rpath/runpath style search path into directories, and expand dynamic string tokens
+                    // entries containing tokens which cannot be expanded are skipped, like the dynamic linker does
+                    static std::vector<std::string> expandSearchPath(const std::string& searchPath,
+                                                                     const boost::filesystem::path& origin,
+                                                                     uint8_t elfClass);
+            };
+        }
+    }
+}
@@ -1,5 +1,8 @@
 // system includes
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
 // library includes
 #include <boost/filesystem.hpp>
@@ -29,19 +32,32 @@ namespace linuxdeploy {
                     // this is the function signature of std::endl
                     typedef CoutType& (* stdEndlType)(CoutType&);
 
+                    // text of the statement being logged
+                    // the buffer is shared by all the objects created by the insertion operators, and is written to
+                    // the stream at once when a line is complete, therefore messages logged by different threads don't
+                    // interleave; text not terminated by std::endl is written once the statement is complete
+                    typedef std::shared_ptr<std::ostringstream> BufferType;
+
                 private:
                     static LD_LOGLEVEL verbosity;
 
+                    // held while writing to the stream only
+                    static std::mutex mutex;
+
                 private:
                     bool prependSpace;
                     bool logLevelSet;
-                    CoutType& stream = std::cout;
 
                     LD_LOGLEVEL currentLogLevel;
 
+                    BufferType buffer;
+
                 private:
                     // advanced behavior
-                    ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel);
+                    ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel, BufferType buffer);
+
+                    // write the buffered text to the stream, and clear the buffer
+                    static void writeBuffer(std::ostringstream& buffer);
 
                     void checkPrependSpace();
 
@@ -0,0 +1,77 @@
+// system includes
+#include <string>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace metadatacache {
+            /*
+             * Persistent cache for information about files which is expensive to compute, e.g., the resolved
+             * dependencies of ELF files, or the copyright files found in the dpkg database.
+             *
+             * Entries are keyed by the path and the identity of a file (device, inode, size and modification time), by
+             * the configuration of the dynamic linker, and by the dpkg database. If any of these change, the entries
+             * become invalid.
+             *
+             * Every file has its own entry file in the cache directory, which is replaced atomically, therefore multiple
+             * linuxdeploy processes can share the same cache directory.
+             *
+             * All methods are thread safe.
+             */
+            class MetadataCache {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // use the given directory to store the cache
+                    // the directory is created when the cache is saved for the first time
+                    // packageDatabaseDirectory is the dpkg database the copyright files are looked up in
+                    MetadataCache(const boost::filesystem::path& directory, const boost::filesystem::path& packageDatabaseDirectory);
+                    ~MetadataCache();
+
+                    // default cache directory: $XDG_CACHE_HOME/linuxdeploy, or ~/.cache/linuxdeploy
+                    static boost::filesystem::path getDefaultDirectory();
+
+                    // the directory the cache is stored in
+                    boost::filesystem::path directory() const;
+
+                public:
+                    // look up the direct dependencies of an ELF file resolved with the given inherited DT_RPATH directories
+                    // see ElfFile::resolveNeededLibraries() for the meaning of the parameters
+                    // returns false if there is no valid entry
+                    bool getDependencies(const boost::filesystem::path& path, const std::vector<std::string>& loaderRPathDirectories,
+                                         std::vector<boost::filesystem::path>& dependencies, std::vector<std::string>& rpathDirectories);
+
+                    void setDependencies(const boost::filesystem::path& path, const std::vector<std::string>& loaderRPathDirectories,
+                                         const std::vector<boost::filesystem::path>& dependencies, const std::vector<std::string>& rpathDirectories);
+
+                    // look up whether stripping the ELF file doesn't remove anything (i.e., it has been stripped already)
+                    // returns false if there is no valid entry
+                    bool getStripped(const boost::filesystem::path& path, bool& stripped);
+
+                    void setStripped(const boost::filesystem::path& path, bool stripped);
+
+                    // look up the copyright files that belong to a file
+                    // returns false if there is no valid entry
+                    bool getCopyrightFiles(const boost::filesystem::path& path, std::vector<boost::filesystem::path>& copyrightFiles);
+
+                    void setCopyrightFiles(const boost::filesystem::path& path, const std::vector<boost::filesystem::path>& copyrightFiles);
+
+                    // write all modified entries to the cache directory
+                    // returns true on success, false otherwise
+                    bool save();
+
+                    // number of lookups which could be answered from the cache, and which could not
+                    size_t hits() const;
+                    size_t misses() const;
+            };
+        }
+    }
+}
@@ -0,0 +1,56 @@
+// system includes
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace packageindex {
+            /*
+             * Index of the files installed by the system's package manager, used to look up which package a file
+             * belongs to.
+             *
+             * The index is built from the file lists in dpkg's database (<admin directory>/info/<package>.list) when the first
+             * file is looked up, which is a lot faster than calling dpkg-query for every file.
+             *
+             * All methods are thread safe.
+             */
+            class PackageIndex {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    // use the dpkg database in the given directory
+                    explicit PackageIndex(const boost::filesystem::path& adminDirectory);
+                    ~PackageIndex();
+
+                    PackageIndex(const PackageIndex&) = delete;
+                    PackageIndex& operator=(const PackageIndex&) = delete;
+
+                    // dpkg's database directory, like dpkg-query, $DPKG_ADMINDIR is used if set
+                    static boost::filesystem::path defaultAdminDirectory();
+
+                public:
+                    // the directory containing the database
+                    boost::filesystem::path getAdminDirectory() const;
+
+                    // check whether the database exists
+                    bool isAvailable() const;
+
+                    // look up the package which installed the file
+                    // the path is made absolute, symlinks are not resolved
+                    // if the file belongs to multiple packages, the first one listed in the database is used
+                    // returns false if no package contains the file
+                    bool findPackage(const boost::filesystem::path& path, std::string& packageName);
+
+                    // path of the copyright file of the package (/usr/share/doc/<package>/copyright)
+                    static boost::filesystem::path getCopyrightFilePath(const std::string& packageName);
+            };
+        }
+    }
+}
@@ -0,0 +1,205 @@
+// system includes
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace pathtable {
+            // compact identifier of an interned string
+            // the identifiers are assigned densely, starting at 0, so they can be used as indices into vectors
+            typedef uint32_t StringId;
+
+            /*
+             * Table of interned strings.
+             *
+             * Every distinct string is stored once only, in large blocks of memory which are never reallocated, and is
+             * identified by a StringId. Comparing and hashing the IDs is a lot cheaper than comparing strings, and
+             * storing them requires no allocations.
+             *
+             * Not thread safe.
+             */
+            class StringTable {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    StringTable();
+                    ~StringTable();
+
+                    StringTable(const StringTable&) = delete;
+                    StringTable& operator=(const StringTable&) = delete;
+
+                public:
+                    // look up the ID of the string, adding the string to the table if necessary
+                    StringId intern(const std::string& value);
+
+                    // look up the ID of the string without adding it
+                    // returns false if the string is not in the table
+                    bool find(const std::string& value, StringId& id) const;
+
+                    // the string the ID belongs to
+                    std::string get(StringId id) const;
+
+                    // number of strings in the table
+                    size_t size() const;
+            };
+
+            /*
+             * Table of interned paths.
+             *
+             * Paths are considered equal if their elements are equal, like boost::filesystem::path's comparison operators
+             * do (e.g., a//b and a/b are the same path), therefore they are normalized before they are interned.
+             *
+             * Not thread safe.
+             */
+            class PathTable {
+                private:
+                    StringTable strings;
+
+                    static std::string normalize(const boost::filesystem::path& path);
+
+                public:
+                    StringId intern(const boost::filesystem::path& path) {
+                        return strings.intern(normalize(path));
+                    }
+
+                    bool find(const boost::filesystem::path& path, StringId& id) const {
+                        return strings.find(normalize(path), id);
+                    }
+
+                    boost::filesystem::path get(StringId id) const {
+                        return strings.get(id);
+                    }
+
+                    size_t size() const {
+                        return strings.size();
+                    }
+            };
+
+            /*
+             * Set of interned string IDs.
+             *
+             * As the IDs are dense, membership is stored in a flat vector indexed by the ID. The members can be iterated
+             * in the order they have been inserted.
+             */
+            class IdSet {
+                private:
+                    std::vector<bool> members;
+                    std::vector<StringId> ids;
+
+                public:
+                    // returns true if the ID has not been in the set before
+                    bool insert(StringId id) {
+                        if (id >= members.size())
+                            members.resize(std::max<size_t>(id + 1, members.size() * 2), false);
+
+                        if (members[id])
+                            return false;
+
+                        members[id] = true;
+                        ids.push_back(id);
+                        return true;
+                    }
+
+                    bool contains(StringId id) const {
+                        return id < members.size() && members[id];
+                    }
+
+                    void clear() {
+                        for (const auto id : ids)
+                            members[id] = false;
+
+                        ids.clear();
+                    }
+
+                    size_t size() const {
+                        return ids.size();
+                    }
+
+                    bool empty() const {
+                        return ids.empty();
+                    }
+
+                    std::vector<StringId>::const_iterator begin() const {
+                        return ids.begin();
+                    }
+
+                    std::vector<StringId>::const_iterator end() const {
+                        return ids.end();
+                    }
+            };
+
+            /*
+             * Map from interned string IDs to values.
+             *
+             * Like IdSet, the position of every entry is stored in a flat vector indexed by the ID, and the entries can be
+             * iterated in the order they have been inserted.
+             */
+            template<typename T>
+            class IdMap {
+                public:
+                    typedef std::pair<StringId, T> Entry;
+
+                private:
+                    // position of the entry + 1, or 0 if there is no entry for the ID
+                    std::vector<uint32_t> positions;
+                    std::vector<Entry> entries;
+
+                public:
+                    // look up the value for the ID, inserting a default constructed value if necessary
+                    T& operator[](StringId id) {
+                        if (id >= positions.size())
+                            positions.resize(std::max<size_t>(id + 1, positions.size() * 2), 0);
+
+                        if (positions[id] == 0) {
+                            entries.push_back(Entry(id, T()));
+                            positions[id] = static_cast<uint32_t>(entries.size());
+                        }
+
+                        return entries[positions[id] - 1].second;
+                    }
+
+                    // returns nullptr if there is no entry for the ID
+                    const T* find(StringId id) const {
+                        if (id >= positions.size() || positions[id] == 0)
+                            return nullptr;
+
+                        return &(entries[positions[id] - 1].second);
+                    }
+
+                    void clear() {
+                        for (const auto& entry : entries)
+                            positions[entry.first] = 0;
+
+                        entries.clear();
+                    }
+
+                    size_t size() const {
+                        return entries.size();
+                    }
+
+                    bool empty() const {
+                        return entries.empty();
+                    }
+
+                    typename std::vector<Entry>::const_iterator begin() const {
+                        return entries.begin();
+                    }
+
+                    typename std::vector<Entry>::const_iterator end() const {
+                        return entries.end();
+                    }
+            };
+        }
+    }
+}
@@ -0,0 +1,53 @@
+// system includes
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace patternmatcher {
+            /*
+             * Matches filenames against a set of names and shell wildcard patterns (like fnmatch() with FNM_PATHNAME).
+             *
+             * The set is compiled when it is created or changed: the names are stored in a perfect hash table, and the
+             * patterns are combined into a single deterministic automaton. Therefore, matching a filename takes a single
+             * lookup in the hash table and a single pass over the filename, regardless of the number of names and
+             * patterns.
+             *
+             * Supported wildcards are *, ? and bracket expressions ([abc], [a-z], [!abc], [[:alpha:]] etc.); a backslash
+             * quotes the following character. Like fnmatch(), a [ without a matching ] is an ordinary character.
+             *
+             * matches() is thread safe, the other methods are not.
+             */
+            class PatternMatcher {
+                private:
+                    // private data class pattern
+                    class PrivateData;
+                    PrivateData* d;
+
+                public:
+                    PatternMatcher();
+
+                    // create matcher for the given names, which are matched literally, and patterns
+                    // the patterns may be names as well, which are recognized and matched literally
+                    PatternMatcher(const std::vector<std::string>& names, const std::vector<std::string>& patterns);
+
+                    ~PatternMatcher();
+
+                    PatternMatcher(const PatternMatcher&) = delete;
+                    PatternMatcher& operator=(const PatternMatcher&) = delete;
+
+                public:
+                    // add pattern to the set, which is compiled again
+                    void addPattern(const std::string& pattern);
+
+                    // check whether the filename matches any of the names or patterns
+                    bool matches(const std::string& filename) const;
+
+                    // check whether the pattern contains any wildcards
+                    static bool containsWildcards(const std::string& pattern);
+            };
+        }
+    }
+}
@@ -0,0 +1,83 @@
+// system includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// library includes
+#include <boost/filesystem.hpp>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace core {
+        namespace storage {
+            // offset basis of the 64-bit FNV-1a hash
+            const uint64_t FNV1A_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+            // 64-bit FNV-1a hash, which is stable across builds and platforms, unlike std::hash
+            // data can be hashed in pieces by passing the hash of the previous pieces as the initial value
+            uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS);
+            uint64_t fnv1a(const std::string& data, uint64_t hash = FNV1A_OFFSET_BASIS);
+
+            /*
+             * Streaming implementation of the 64-bit xxHash (XXH64), which hashes large amounts of data much faster
+             * than FNV-1a. The result doesn't depend on how the data is split into pieces.
+             */
+            class Xxh64 {
+                private:
+                    uint64_t accumulators[4];
+                    uint64_t seed;
+                    uint64_t totalSize;
+
+                    // data which doesn't fill a complete 32 byte stripe yet
+                    unsigned char buffer[32];
+                    size_t bufferSize;
+
+                public:
+                    explicit Xxh64(uint64_t seed = 0);
+
+                public:
+                    void update(const void* data, size_t size);
+                    uint64_t digest() const;
+            };
+
+            // hash the contents of a file with XXH64
+            // a scalar hash was chosen on purpose, as reading the file dominates the cost anyway
+            // returns false if the file cannot be read
+            bool hashFile(const boost::filesystem::path& path, uint64_t& hash);
+
+            // format value as 16 hexadecimal digits
+            std::string toHex(uint64_t value);
+
+            // describe the identity of a file (device, inode, size and modification time), which changes whenever the
+            // file is replaced or modified
+            // returns an empty string if the file doesn't exist
+            std::string describeFile(const boost::filesystem::path& path);
+
+            // check whether the value can be stored on a single line
+            bool isSingleLine(const std::string& value);
+
+            // replace the file with the given contents atomically, so that readers (or an interrupted run) never see
+            // a partially written file
+            // the contents are written to a temporary file next to it first, which is renamed to path
+            // returns false on errors, the file is left unchanged then
+            bool writeFileAtomically(const boost::filesystem::path& path, const std::string& contents);
+
+            /*
+             * Turns paths into keys relative to an AppDir, so that files stored in the AppDir remain valid if the AppDir
+             * is moved. Paths outside the AppDir are made absolute.
+             */
+            class AppDirKeys {
+                private:
+                    // absolute path of the AppDir, including a trailing slash
+                    std::string appDirPrefix;
+
+                public:
+                    explicit AppDirKeys(const boost::filesystem::path& appDirPath);
+
+                public:
+                    std::string getKey(const boost::filesystem::path& path) const;
+            };
+        }
+    }
+}
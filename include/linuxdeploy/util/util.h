@@ -1,6 +1,7 @@
 // local includes
 #include "magicwrapper.h"
 #include "misc.h"
+#include "threadpool.h"
 
 // import functions from misc module for convenience
 namespace linuxdeploy {
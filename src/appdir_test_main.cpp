@@ -19,14 +19,14 @@ int main(const int argc, const char* const* const argv) {
     args::ValueFlag<std::string> listFilesInDirectoryRecursively(parser, "", "List files in directory relative to AppDir", {"list-files-in-directory-recursively"});
 
     if (listFilesInDirectory) {
-        for (const auto& i : appdir::listFilesInDirectory(listFilesInDirectory.Get(), false)) {
+        for (const auto& i : appdirindex::listRegularFiles(listFilesInDirectory.Get(), false)) {
             std::cout << i.string() << std::endl;
         }
         return 1;
     }
 
     if (listFilesInDirectoryRecursively) {
-        for (const auto& i : appdir::listFilesInDirectory(listFilesInDirectoryRecursively.Get(), true)) {
+        for (const auto& i : appdirindex::listRegularFiles(listFilesInDirectoryRecursively.Get(), true)) {
             std::cout << i.string() << std::endl;
         }
         return 1;
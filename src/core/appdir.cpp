@@ -1,18 +1,39 @@
 // system headers
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
 #include <vector>
 
 // library headers
 #include <boost/filesystem.hpp>
 #include <CImg.h>
-#include <fnmatch.h>
-#include <subprocess.hpp>
 
 // local headers
 #include "linuxdeploy/core/appdir.h"
+#include "linuxdeploy/core/appdirindex.h"
+#include "linuxdeploy/core/appdirjournal.h"
+#include "linuxdeploy/core/appdirmanifest.h"
 #include "linuxdeploy/core/elf.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/metadatacache.h"
+#include "linuxdeploy/core/packageindex.h"
+#include "linuxdeploy/core/pathtable.h"
+#include "linuxdeploy/core/patternmatcher.h"
+#include "linuxdeploy/core/storage.h"
 #include "linuxdeploy/util/util.h"
 #include "excludelist.h"
 
@@ -22,6 +43,11 @@ using namespace linuxdeploy::core::log;
 using namespace cimg_library;
 namespace bf = boost::filesystem;
 
+// available since Linux 4.5, defined in linux/fs.h, which might not be available or too old
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
 namespace linuxdeploy {
     namespace core {
         namespace appdir {
@@ -29,234 +55,1141 @@ namespace linuxdeploy {
                 public:
                     bf::path appDirPath;
 
+                    // all the paths and rpath values used in the bookkeeping below are interned, so the containers
+                    // can use compact IDs instead of strings
+                    pathtable::PathTable paths;
+                    pathtable::StringTable rpaths;
+
                     // store deferred operations
                     // these can be executed by calling excuteDeferredOperations
-                    std::map<bf::path, bf::path> copyOperations;
-                    std::set<bf::path> stripOperations;
-                    std::map<bf::path, std::string> setElfRPathOperations;
+                    pathtable::IdMap<pathtable::StringId> copyOperations;
+                    pathtable::IdSet stripOperations;
+                    pathtable::IdMap<pathtable::StringId> setElfRPathOperations;
+
+                    // destinations of copy operations which have to be made executable (e.g., executables in usr/bin)
+                    pathtable::IdSet executableFiles;
 
                     // stores all files that have been visited by the deploy functions, e.g., when they're blacklisted,
                     // have been added to the deferred operations already, etc.
                     // lookups in a single container are a lot faster than having to look up in several ones, therefore
                     // the little amount of additional memory is worth it, considering the improved performance
-                    std::set<bf::path> visitedFiles;
+                    pathtable::IdSet visitedFiles;
+
+                    // identity of a file on disk
+                    // the same file can be reached via many paths, e.g., via soname symlinks, or via /lib and /usr/lib
+                    // on systems with merged /usr
+                    typedef std::pair<dev_t, ino_t> FileId;
+
+                    // destinations the files have been copied to, by identity
+                    // files reached via another path are copied once only, the other destinations become symlinks to
+                    // the copy
+                    std::map<FileId, pathtable::StringId> fileDestinations;
+
+                    // symlinks to the copies of files which have been deployed via multiple paths, created after the
+                    // files have been copied
+                    pathtable::IdMap<pathtable::StringId> symlinkOperations;
+
+                    // node in the dependency graph
+                    struct DependencyNode {
+                        // libraries the file depends on directly
+                        std::vector<bf::path> dependencies;
+
+                        // DT_RPATH directories inherited by the dependencies
+                        std::vector<std::string> rpathDirectories;
+                    };
+
+                    // dependency graph of all the ELF files processed so far, by identity
+                    // every file is resolved once only, therefore shared dependencies (e.g., libc or Qt libraries)
+                    // don't have to be traced again and again, regardless of the paths they are reached via
+                    std::map<FileId, DependencyNode> dependencyGraph;
+
+                    // nodes resolved in parallel by resolveDependencies() before the files are deployed
+                    // as the inherited DT_RPATH directories depend on the order in which the files are visited, the
+                    // nodes are keyed by the file and the inherited directories, and are moved into the dependency
+                    // graph by getDependencyNode() as the deployment proceeds in the usual order
+                    std::map<std::pair<FileId, std::vector<std::string>>, DependencyNode> resolvedNodes;
+                    std::mutex resolvedNodesMutex;
 
                     // used to automatically rename resources to improve the UX, e.g. icons
                     std::string appName;
 
+                    // number of threads used to process files in parallel (0 means one per CPU core)
+                    size_t jobs;
+
+                    LinkMode linkMode;
+
+                    // optional persistent cache for information about the deployed files
+                    std::unique_ptr<metadatacache::MetadataCache> cache;
+
+                    // optional manifest of the files in the AppDir, used to skip files which are up to date
+                    std::unique_ptr<appdirmanifest::AppDirManifest> manifest;
+
+                    // journal of the deferred operations, used to resume interrupted runs
+                    std::unique_ptr<appdirjournal::AppDirJournal> journal;
+                    bool resume;
+
+                    // index of the files in the AppDir, kept up to date with the files created by linuxdeploy
+                    std::unique_ptr<appdirindex::AppDirIndex> index;
+
+                    // used to look up the packages the deployed files belong to, e.g., to find their copyright files
+                    std::unique_ptr<packageindex::PackageIndex> packageIndex;
+
+                    // libraries which are not deployed, the generated excludelist plus the user's patterns
+                    patternmatcher::PatternMatcher excludelist;
+
                 public:
-                    PrivateData() : copyOperations(), stripOperations(), setElfRPathOperations(), visitedFiles(), appDirPath(), appName() {};
+                    PrivateData() : appDirPath(), paths(), rpaths(), copyOperations(), stripOperations(), setElfRPathOperations(), executableFiles(), visitedFiles(),
+                                    fileDestinations(), symlinkOperations(), dependencyGraph(), resolvedNodes(), resolvedNodesMutex(), appName(), jobs(0), linkMode(LINK_MODE_COPY), cache(), manifest(), journal(), resume(false), index(),
+                                    packageIndex(new packageindex::PackageIndex(packageindex::PackageIndex::defaultAdminDirectory())),
+                                    excludelist(generatedExcludelistNames, generatedExcludelistPatterns) {};
 
                 public:
-                    // actually copy file
+                    // determine the actual destination of a copy operation and create its parent directory
                     // mimics cp command behavior
-                    bool copyFile(const bf::path& from, bf::path to, bool overwrite = false) {
-                        ldLog() << "Copying file" << from << "to" << to << std::endl;
-
+                    // returns an empty path on errors
+                    static bf::path prepareCopyDestination(const bf::path& from, bf::path to) {
                         try {
                             if (!to.parent_path().empty() && !bf::is_directory(to.parent_path()) && !bf::create_directories(to.parent_path())) {
-                                ldLog() << LD_ERROR << "Failed to create parent directory" << to.parent_path() << "for path" << to << std::endl;
-                                return false;
+                                // another thread might have created the directory in the meantime
+                                if (!bf::is_directory(to.parent_path())) {
+                                    ldLog() << LD_ERROR << "Failed to create parent directory" << to.parent_path() << "for path" << to << std::endl;
+                                    return bf::path();
+                                }
                             }
 
                             if (*(to.string().end() - 1) == '/' || bf::is_directory(to))
                                 to /= from.filename();
+                        } catch (const bf::filesystem_error& e) {
+                            ldLog() << LD_ERROR << "Failed to copy file" << from << "to" << to << LD_NO_SPACE << ":" << e.what() << std::endl;
+                            return bf::path();
+                        }
 
-                            if (!overwrite && bf::exists(to)) {
-                                ldLog() << LD_DEBUG << "File exists, skipping:" << to << std::endl;
-                                return true;
+                        return to;
+                    }
+
+                    // copy a chunk of data from in to out, using the file offsets of both
+                    // the data is copied within the kernel using copy_file_range() or sendfile() if possible, method
+                    // tracks which of the system calls are supported for this pair of files
+                    // returns the number of bytes copied, or -1 on errors (see errno)
+                    enum CopyMethod { COPY_FILE_RANGE = 0, SENDFILE, READ_WRITE };
+
+                    static ssize_t copyChunk(int in, int out, size_t count, CopyMethod& method) {
+                        while (true) {
+                            ssize_t result;
+
+                            switch (method) {
+                                case COPY_FILE_RANGE:
+#ifdef __NR_copy_file_range
+                                    result = syscall(__NR_copy_file_range, in, nullptr, out, nullptr, count, 0);
+
+                                    // not supported by the kernel, or for this combination of filesystems
+                                    if (result < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                                        method = SENDFILE;
+                                        continue;
+                                    }
+
+                                    return result;
+#else
+                                    method = SENDFILE;
+                                    continue;
+#endif
+                                case SENDFILE:
+                                    result = sendfile(out, in, nullptr, count);
+
+                                    if (result < 0 && (errno == ENOSYS || errno == EINVAL)) {
+                                        method = READ_WRITE;
+                                        continue;
+                                    }
+
+                                    return result;
+                                default: {
+                                    char buffer[64 * 1024];
+
+                                    result = read(in, buffer, std::min(count, sizeof(buffer)));
+
+                                    if (result <= 0)
+                                        return result;
+
+                                    for (ssize_t written = 0; written < result;) {
+                                        auto writeResult = write(out, buffer + written, static_cast<size_t>(result - written));
+
+                                        if (writeResult < 0) {
+                                            if (errno == EINTR)
+                                                continue;
+
+                                            return -1;
+                                        }
+
+                                        written += writeResult;
+                                    }
+
+                                    return result;
+                                }
                             }
+                        }
+                    }
 
-                            bf::copy_file(from, to, bf::copy_option::overwrite_if_exists);
-                        } catch (const bf::filesystem_error& e) {
-                            ldLog() << LD_ERROR << "Failed to copy file" << from << "to" << to << LD_NO_SPACE << ":" << e.what() << std::endl;
+                    // copy contents and permissions of file to the (prepared) destination
+                    // if makeExecutable is set, the executable bits are set for everyone who may read the file
+                    static bool copyFileData(const bf::path& from, const bf::path& to, bool makeExecutable) {
+                        auto logError = [&from, &to](const std::string& message) {
+                            ldLog() << LD_ERROR << "Failed to copy file" << from << "to" << to << LD_NO_SPACE << ":" << message << std::endl;
                             return false;
+                        };
+
+                        auto in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (in < 0)
+                            return logError(strerror(errno));
+
+                        struct stat statData{};
+
+                        if (fstat(in, &statData) != 0) {
+                            auto error = errno;
+                            close(in);
+                            return logError(strerror(error));
+                        }
+
+                        auto mode = statData.st_mode & 07777;
+
+                        if (makeExecutable)
+                            mode |= (mode & 0444) >> 2;
+
+                        auto out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+
+                        if (out < 0) {
+                            auto error = errno;
+                            close(in);
+                            return logError(strerror(error));
+                        }
+
+                        bool success = true;
+                        std::string error;
+
+                        // the mode passed to open() is subject to the umask, and doesn't apply to existing files
+                        if (fchmod(out, mode) != 0) {
+                            success = false;
+                            error = strerror(errno);
+                        }
+
+                        auto method = COPY_FILE_RANGE;
+
+                        for (off_t remaining = statData.st_size; success && remaining > 0;) {
+                            // sendfile() transfers at most 0x7ffff000 bytes per call
+                            const auto chunkSize = static_cast<size_t>(std::min<off_t>(remaining, 0x40000000));
+
+                            auto result = copyChunk(in, out, chunkSize, method);
+
+                            if (result < 0) {
+                                if (errno == EINTR)
+                                    continue;
+
+                                success = false;
+                                error = strerror(errno);
+                            } else if (result == 0) {
+                                // file has been truncated in the meantime
+                                break;
+                            } else {
+                                remaining -= result;
+                            }
+                        }
+
+                        close(in);
+
+                        if (close(out) != 0 && success) {
+                            success = false;
+                            error = strerror(errno);
                         }
 
+                        if (!success)
+                            return logError(error);
+
                         return true;
                     }
 
+                    // create a reflink (i.e., a copy-on-write copy sharing the data with the source file) of file at the
+                    // (prepared) destination
+                    // returns false if reflinks are not supported, the caller should fall back to copying then
+                    static bool reflinkFile(const bf::path& from, const bf::path& to, bool makeExecutable) {
+                        auto in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (in < 0)
+                            return false;
+
+                        struct stat statData{};
+
+                        if (fstat(in, &statData) != 0) {
+                            close(in);
+                            return false;
+                        }
+
+                        auto mode = statData.st_mode & 07777;
+
+                        if (makeExecutable)
+                            mode |= (mode & 0444) >> 2;
+
+                        auto out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+
+                        if (out < 0) {
+                            close(in);
+                            return false;
+                        }
+
+                        const bool success = ioctl(out, FICLONE, in) == 0 && fchmod(out, mode) == 0;
+
+                        close(in);
+
+                        if (close(out) != 0 || !success) {
+                            unlink(to.c_str());
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // actually copy file
+                    // mimics cp command behavior
+                    bool copyFile(const bf::path& from, bf::path to, bool overwrite = false) {
+                        ldLog() << "Copying file" << from << "to" << to << std::endl;
+
+                        to = prepareCopyDestination(from, to);
+
+                        if (to.empty())
+                            return false;
+
+                        if (!overwrite && bf::exists(to)) {
+                            ldLog() << LD_DEBUG << "File exists, skipping:" << to << std::endl;
+                            return true;
+                        }
+
+                        if (!copyFileData(from, to, false))
+                            return false;
+
+                        index->addFile(to);
+                        return true;
+                    }
+
+                    // file to be copied by the deferred operations
+                    struct CopyJob {
+                        bf::path from;
+                        bf::path to;
+                        uintmax_t size;
+                        bool makeExecutable;
+
+                        // whether the file is going to be modified, and must not be hardlinked therefore
+                        bool modified;
+
+                        // whether an outdated copy has to be replaced
+                        bool replace;
+                    };
+
+                    // ELF file to be stripped and/or whose rpath is to be set by the deferred operations
+                    struct ElfJob {
+                        bf::path path;
+                        bool strip;
+                        bool setRPath;
+                        std::string rpath;
+
+                        // the file is copied from sourcePath in this run, empty if it isn't copied
+                        bf::path sourcePath;
+
+                        // whether the transformations would leave the file unchanged, in which case they are skipped,
+                        // but recorded as if they had been applied
+                        bool alreadyStripped;
+                        bool rpathAlreadySet;
+                    };
+
+                    // determine which of the deferred copy operations have to be executed
+                    // if the manifest is used, files which are up to date are skipped, and added to upToDateFiles
+                    // returns false if a destination cannot be prepared, the other operations are planned nevertheless
+                    bool planCopyJobs(bool strip, std::vector<CopyJob>& copyJobs, std::set<bf::path>& upToDateFiles) {
+                        std::set<bf::path> destinations;
+                        bool success = true;
+
+                        // the destinations are determined in the order of the source paths, so that if multiple files
+                        // are copied to the same destination, the same file is copied in every run
+                        for (const auto fromId : sortedIds(copyOperations)) {
+                            const auto toId = *copyOperations.find(fromId);
+
+                            const auto from = paths.get(fromId);
+                            const auto plannedTo = paths.get(toId);
+
+                            ldLog() << "Copying file" << from << "to" << plannedTo << std::endl;
+
+                            const auto to = prepareCopyDestination(from, plannedTo);
+
+                            if (to.empty()) {
+                                success = false;
+                                continue;
+                            }
+
+                            const bool queuedForStripping = isQueuedForStripping(to);
+                            const bool stripFile = strip && queuedForStripping;
+
+                            std::string rpath;
+                            const bool setRPath = findRPathOperation(to, rpath);
+
+                            bool replace = false;
+
+                            // files in the AppDir are deployed again when deploying the dependencies of existing files,
+                            // which must not replace the file with itself, nor keep its actual source file from being
+                            // copied
+                            boost::system::error_code ec;
+
+                            if (bf::equivalent(from, to, ec)) {
+                                ldLog() << LD_DEBUG << "File exists, skipping:" << to << std::endl;
+                                continue;
+                            }
+
+                            if (!destinations.insert(to).second) {
+                                ldLog() << LD_DEBUG << "File exists, skipping:" << to << std::endl;
+                                continue;
+                            }
+
+                            // files which have been copied from the same file in a previous run are replaced if the
+                            // source file, the transformations or the copy have changed
+                            // other existing files are never overwritten
+                            if (bf::exists(to) && resume && journal->wasCopyPlanned(to)) {
+                                // the interrupted run might have been copying the file
+                                if (journal->wasCopyCompleted(to, from)) {
+                                    ldLog() << LD_DEBUG << "File has been copied by interrupted run, skipping:" << to << std::endl;
+
+                                    // the completion is recorded again, in case this run is interrupted, too
+                                    journal->planCopy(to, from);
+                                    journal->copyCompleted(to);
+                                    continue;
+                                }
+
+                                ldLog() << LD_DEBUG << "File might have been copied partially by interrupted run, replacing:" << to << std::endl;
+                                replace = true;
+                            } else if (bf::exists(to)) {
+                                if (manifest == nullptr || !manifest->wasCopiedFrom(to, from)) {
+                                    ldLog() << LD_DEBUG << "File exists, skipping:" << to << std::endl;
+                                    continue;
+                                }
+
+                                if (manifest->isUpToDate(to, from, stripFile, setRPath, rpath)) {
+                                    ldLog() << LD_DEBUG << "File is up to date, skipping:" << to << std::endl;
+                                    upToDateFiles.insert(to);
+                                    continue;
+                                }
+
+                                ldLog() << LD_DEBUG << "File is outdated, replacing:" << to << std::endl;
+                                replace = true;
+                            }
+
+                            const auto size = bf::file_size(from, ec);
+
+                            const bool makeExecutable = executableFiles.contains(toId);
+
+                            const bool modified = queuedForStripping || setRPath;
+
+                            copyJobs.push_back({from, to, ec ? 0 : size, makeExecutable, modified, replace});
+                        }
+
+                        copyOperations.clear();
+                        executableFiles.clear();
+
+                        return success;
+                    }
+
+                    // resolve the symlinks in path, like realpath(1) -m does; the parts of the path which don't exist are
+                    // normalized lexically
+                    // the results for the directories are cached in canonicalDirectories, as links are often created in
+                    // batches in few directories
+                    static bf::path canonicalizeDirectory(const bf::path& directory, std::map<bf::path, bf::path>& canonicalDirectories) {
+                        const auto absoluteDirectory = bf::absolute(directory);
+
+                        auto it = canonicalDirectories.find(absoluteDirectory);
+
+                        if (it == canonicalDirectories.end())
+                            it = canonicalDirectories.insert(std::make_pair(absoluteDirectory, bf::weakly_canonical(absoluteDirectory))).first;
+
+                        return it->second;
+                    }
+
+                    static bf::path canonicalizePath(const bf::path& path, std::map<bf::path, bf::path>& canonicalDirectories) {
+                        const auto absolutePath = bf::absolute(path);
+
+                        const auto result = canonicalizeDirectory(absolutePath.parent_path(), canonicalDirectories) / absolutePath.filename();
+
+                        // the last component might be a symlink itself
+                        boost::system::error_code ec;
+                        if (bf::is_symlink(bf::symlink_status(result, ec)))
+                            return bf::weakly_canonical(result);
+
+                        return result.lexically_normal();
+                    }
+
                     // create symlink
+                    // mimics the behavior of ln -f -s [--relative]: if symlink is a directory, the link is created in
+                    // it; existing files are replaced
+                    // with useRelativePath, the link points to the target relative to the link's directory, using the
+                    // paths with all symlinks resolved, otherwise it points to the absolute path of the target
                     bool symlinkFile(const bf::path& target, const bf::path& symlink, const bool useRelativePath = true) {
+                        std::map<bf::path, bf::path> canonicalDirectories;
+                        return symlinkFile(target, symlink, useRelativePath, canonicalDirectories);
+                    }
+
+                    bool symlinkFile(const bf::path& target, bf::path symlink, const bool useRelativePath,
+                                     std::map<bf::path, bf::path>& canonicalDirectories) {
                         ldLog() << "Creating symlink for file" << target << "in/as" << symlink << std::endl;
 
-                        /*try {
-                            if (!symlink.parent_path().empty() && !bf::is_directory(symlink.parent_path()) && !bf::create_directories(symlink.parent_path())) {
-                                ldLog() << LD_ERROR << "Failed to create parent directory" << symlink.parent_path() << "for path" << symlink << std::endl;
-                                return false;
-                            }
+                        bf::path linkTarget;
 
-                            if (*(symlink.string().end() - 1) == '/' || bf::is_directory(symlink))
+                        try {
+                            if (symlink.string().back() == '/' || bf::is_directory(symlink))
                                 symlink /= target.filename();
 
-                            if (bf::exists(symlink) || bf::symbolic_link_exists(symlink))
-                                bf::remove(symlink);
+                            if (useRelativePath) {
+                                const auto canonicalTarget = canonicalizePath(target, canonicalDirectories);
+                                // the link itself might exist already, and must not be resolved
+                                const auto canonicalLinkDirectory = canonicalizeDirectory(bf::absolute(symlink).parent_path(), canonicalDirectories);
 
-                            if (relativeDirectory != "") {
-                                // TODO
+                                linkTarget = canonicalTarget.lexically_relative(canonicalLinkDirectory);
+                            } else {
+                                linkTarget = bf::absolute(target);
                             }
-
-                            bf::create_symlink(target, symlink);
                         } catch (const bf::filesystem_error& e) {
-                            return false;
-                        }*/
-
-                        if (!useRelativePath) {
-                            ldLog() << LD_ERROR << "Not implemented" << std::endl;
+                            ldLog() << LD_ERROR << "Failed to create symlink" << symlink << LD_NO_SPACE << ":" << e.what() << std::endl;
                             return false;
                         }
 
-                        subprocess::Popen proc({"ln", "-f", "-s", "--relative", target.c_str(), symlink.c_str()},
-                            subprocess::output(subprocess::PIPE),
-                            subprocess::error(subprocess::PIPE)
-                        );
+                        if (linkTarget.empty())
+                            linkTarget = ".";
+
+                        // the link is created under a temporary name and renamed, so that existing files are replaced
+                        // atomically
+                        static std::atomic<unsigned long> counter(0);
+
+                        const auto temporaryPath = symlink.string() + ".linuxdeploy-link." + std::to_string(getpid()) + "." + std::to_string(counter++);
 
-                        auto outputs = proc.communicate();
+                        if (::symlink(linkTarget.c_str(), temporaryPath.c_str()) != 0) {
+                            ldLog() << LD_ERROR << "Failed to create symlink" << symlink << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            return false;
+                        }
 
-                        if (proc.retcode() != 0) {
-                            ldLog() << LD_ERROR << "ln subprocess failed:" << std::endl
-                                    << outputs.first.buf << std::endl << outputs.second.buf << std::endl;
+                        if (rename(temporaryPath.c_str(), symlink.c_str()) != 0) {
+                            ldLog() << LD_ERROR << "Failed to create symlink" << symlink << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                            unlink(temporaryPath.c_str());
                             return false;
                         }
 
+                        index->addFile(symlink);
                         return true;
                     }
 
                     bool hasBeenVisitedAlready(const bf::path& path) {
-                        return visitedFiles.find(path) != visitedFiles.end();
+                        pathtable::StringId id;
+                        return paths.find(path, id) && visitedFiles.contains(id);
                     }
 
-                    // execute deferred copy operations registered with the deploy* functions
-                    bool executeDeferredOperations() {
+                    // returns false if the file doesn't exist
+                    static bool getFileId(const bf::path& path, FileId& fileId) {
+                        struct stat statData{};
+
+                        if (stat(path.c_str(), &statData) != 0)
+                            return false;
+
+                        fileId = FileId(statData.st_dev, statData.st_ino);
+                        return true;
+                    }
+
+                    // check whether the file has been copied already via another path (or to another destination)
+                    // if the destination is in the same directory as the copy, a symlink to the copy is created there
+                    // later on; copies in other directories are kept, as their rpaths are relative to their locations
+                    // returns true if the file doesn't have to be copied to the destination
+                    bool deployAlias(const bf::path& from, const bf::path& to, const std::string& logPrefix = "") {
+                        FileId fileId;
+
+                        if (!getFileId(from, fileId))
+                            return false;
+
+                        const auto it = fileDestinations.find(fileId);
+
+                        if (it == fileDestinations.end())
+                            return false;
+
+                        const auto copy = paths.get(it->second);
+
+                        if (copy.parent_path() != to.parent_path())
+                            return false;
+
+                        // mark file as visited
+                        visitedFiles.insert(paths.intern(from));
+
+                        if (copy == to) {
+                            ldLog() << LD_DEBUG << logPrefix << LD_NO_SPACE << "File has been deployed via another path already:" << from << std::endl;
+                            return true;
+                        }
+
+                        ldLog() << logPrefix << LD_NO_SPACE << "Deploying file" << from << "as symlink to" << copy << std::endl;
+                        symlinkOperations[paths.intern(to)] = it->second;
+
+                        return true;
+                    }
+
+                    // create the symlinks for the files which have been deployed via multiple paths
+                    // like copies, they never replace existing files
+                    bool executeSymlinkOperations() {
+                        std::map<bf::path, bf::path> canonicalDirectories;
+                        size_t createdSymlinks = 0;
                         bool success = true;
 
-                        while (!copyOperations.empty()) {
-                            const auto& pair = *(copyOperations.begin());
-                            const auto& from = pair.first;
-                            const auto& to = pair.second;
+                        for (const auto linkId : sortedIds(symlinkOperations)) {
+                            const auto link = paths.get(linkId);
+                            const auto target = paths.get(*symlinkOperations.find(linkId));
 
-                            if (!copyFile(from, to))
-                                success = false;
+                            boost::system::error_code ec;
+                            const auto status = bf::symlink_status(link, ec);
 
-                            copyOperations.erase(copyOperations.begin());
+                            if (bf::exists(status) && !bf::is_symlink(status)) {
+                                ldLog() << LD_DEBUG << "File exists, skipping:" << link << std::endl;
+                                continue;
+                            }
+
+                            if (symlinkFile(target, link, true, canonicalDirectories))
+                                createdSymlinks++;
+                            else
+                                success = false;
                         }
 
-                        if (!success)
+                        if (createdSymlinks > 0)
+                            ldLog() << "Created" << createdSymlinks << "symlinks for files deployed via multiple paths" << std::endl;
+
+                        symlinkOperations.clear();
+
+                        return success;
+                    }
+
+                    bool isQueuedForStripping(const bf::path& path) {
+                        pathtable::StringId id;
+                        return paths.find(path, id) && stripOperations.contains(id);
+                    }
+
+                    // look up the rpath file will be set to
+                    // returns false if the rpath of the file isn't going to be set
+                    bool findRPathOperation(const bf::path& path, std::string& rpath) {
+                        pathtable::StringId id;
+
+                        if (!paths.find(path, id))
                             return false;
 
-                        if (getenv("NO_STRIP") != nullptr) {
-                            ldLog() << LD_WARNING << "$NO_STRIP environment variable detected, not stripping binaries" << std::endl;
-                            stripOperations.clear();
-                        } else {
-                            while (!stripOperations.empty()) {
-                                const auto& filePath = *(stripOperations.begin());
+                        const auto* rpathId = setElfRPathOperations.find(id);
+
+                        if (rpathId == nullptr)
+                            return false;
+
+                        rpath = rpaths.get(*rpathId);
+                        return true;
+                    }
+
+                    void addStripOperation(const bf::path& path) {
+                        stripOperations.insert(paths.intern(path));
+                    }
+
+                    void addSetRPathOperation(const bf::path& path, const std::string& rpath) {
+                        setElfRPathOperations[paths.intern(path)] = rpaths.intern(rpath);
+                    }
+
+                    // list the IDs of the paths in the given container, sorted like the paths
+                    template<typename Container>
+                    std::vector<pathtable::StringId> sortedIds(const Container& container) {
+                        std::vector<std::pair<bf::path, pathtable::StringId>> entries;
+
+                        for (const auto& entry : container)
+                            entries.push_back(std::make_pair(paths.get(getId(entry)), getId(entry)));
+
+                        std::sort(entries.begin(), entries.end());
+
+                        std::vector<pathtable::StringId> ids;
+
+                        for (const auto& entry : entries)
+                            ids.push_back(entry.second);
+
+                        return ids;
+                    }
+
+                    static pathtable::StringId getId(pathtable::StringId id) {
+                        return id;
+                    }
+
+                    template<typename T>
+                    static pathtable::StringId getId(const std::pair<pathtable::StringId, T>& entry) {
+                        return entry.first;
+                    }
+
+                    // many files are stripped already, or have the right rpath already, which is checked natively
+                    // using the files which are going to be copied, so that they don't have to be modified, and may
+                    // even be hardlinked
+                    void eliminateNoOpElfOperations(std::vector<ElfJob>& elfJobs) {
+                        size_t skippedStripOperations = 0;
+                        size_t skippedRPathOperations = 0;
+
+                        for (auto& job : elfJobs) {
+                            const auto& inspectedPath = job.sourcePath.empty() ? job.path : job.sourcePath;
+
+                            try {
+                                elf::ElfFile file(inspectedPath);
+
+                                if (job.strip) {
+                                    // the metadata cache knows whether files have been stripped in previous runs
+                                    bool sourceStripped = false;
+
+                                    if (!job.sourcePath.empty() && cache != nullptr && cache->getStripped(job.sourcePath, sourceStripped)) {
+                                        job.alreadyStripped = sourceStripped;
+                                    } else {
+                                        job.alreadyStripped = file.isStripped();
+
+                                        if (!job.sourcePath.empty() && cache != nullptr)
+                                            cache->setStripped(job.sourcePath, job.alreadyStripped);
+                                    }
+                                }
+
+                                if (job.setRPath)
+                                    job.rpathAlreadySet = file.hasRPath(job.rpath);
+                            } catch (const elf::ElfFileParseError&) {
+                                // the errors are reported when the operations fail
+                                continue;
+                            }
+
+                            if (job.alreadyStripped) {
+                                ldLog() << LD_DEBUG << "ELF file is stripped already, skipping:" << job.path << std::endl;
+                                skippedStripOperations++;
+                            }
+
+                            if (job.rpathAlreadySet) {
+                                ldLog() << LD_DEBUG << "rpath is set already, skipping:" << job.path << std::endl;
+                                skippedRPathOperations++;
+                            }
+                        }
+
+                        if (skippedStripOperations > 0 || skippedRPathOperations > 0) {
+                            ldLog() << "Skipped" << skippedStripOperations << "strip and" << skippedRPathOperations
+                                    << "rpath operations which would not change the files" << std::endl;
+                        }
+                    }
+
+                    // execute deferred operations registered with the deploy* functions
+                    // every file passes through a pipeline of operations: it is copied, then stripped, then its rpath
+                    // is set; the copies are executed by a lane of I/O threads, the ELF files are processed by a lane of
+                    // CPU threads, and a file is handed over to the CPU lane as soon as it has been copied, so that
+                    // copying and processing the files overlap
+                    bool executeDeferredOperations() {
+                        // files which are up to date according to the manifest, and don't have to be processed again
+                        std::set<bf::path> upToDateFiles;
+
+                        const bool strip = getenv("NO_STRIP") == nullptr;
+
+                        if (!resume && journal->exists()) {
+                            ldLog() << LD_WARNING << "Found journal of an interrupted run, use --resume to skip the operations which have been completed:"
+                                    << appdirjournal::AppDirJournal::getJournalPath(appDirPath) << std::endl;
+                        }
+
+                        // the journal is left behind if an operation fails, so the run can be resumed
+                        journal->begin();
+
+                        std::vector<CopyJob> copyJobs;
+                        bool success = planCopyJobs(strip, copyJobs, upToDateFiles);
+
+                        // the files which are about to be written must be known when resuming, even after a crash
+                        for (const auto& job : copyJobs)
+                            journal->planCopy(job.to, job.from);
+
+                        journal->sync();
+
+                        // the largest files are copied first, so the copying doesn't end with a single thread copying a
+                        // large file
+                        std::stable_sort(copyJobs.begin(), copyJobs.end(), [](const CopyJob& a, const CopyJob& b) {
+                            return a.size > b.size;
+                        });
+
+                        if (!strip) {
+                            ldLog() << LD_WARNING << "$NO_STRIP environment variable detected, not stripping binaries" << std::endl;
+                            stripOperations.clear();
+                        }
+
+                        // the files which are copied in this run are identical to their source files, therefore
+                        // information about the source files can be used for them
+                        std::map<bf::path, bf::path> copySources;
+                        for (const auto& job : copyJobs)
+                            copySources[job.to] = job.from;
+
+                        // every ELF file is handled by a single task, therefore stripping a file always finishes before
+                        // its rpath is set
+                        pathtable::IdSet elfFileIds;
+                        for (const auto id : stripOperations)
+                            elfFileIds.insert(id);
+                        for (const auto& pair : setElfRPathOperations)
+                            elfFileIds.insert(pair.first);
+
+                        std::vector<ElfJob> elfJobs;
+                        size_t skippedFiles = 0;
+
+                        for (const auto fileId : sortedIds(elfFileIds)) {
+                            ElfJob job{};
+                            job.path = paths.get(fileId);
+                            job.strip = stripOperations.contains(fileId);
+
+                            const auto* rpathId = setElfRPathOperations.find(fileId);
+                            job.setRPath = rpathId != nullptr;
+                            job.rpath = job.setRPath ? rpaths.get(*rpathId) : "";
+
+                            const auto copySourceIt = copySources.find(job.path);
+                            if (copySourceIt != copySources.end())
+                                job.sourcePath = copySourceIt->second;
+
+                            // files which aren't copied in this run might have been processed in a previous run
+                            if (upToDateFiles.find(job.path) != upToDateFiles.end() ||
+                                (job.sourcePath.empty() && manifest != nullptr && manifest->areTransformationsApplied(job.path, job.strip, job.setRPath, job.rpath))) {
+                                ldLog() << LD_DEBUG << "ELF file is up to date, skipping:" << job.path << std::endl;
+                                skippedFiles++;
+                                continue;
+                            }
+
+                            journal->planElfProcessing(job.path, job.strip, job.setRPath, job.rpath);
+
+                            if (job.sourcePath.empty() && resume && journal->wasElfProcessingCompleted(job.path, job.strip, job.setRPath, job.rpath)) {
+                                ldLog() << LD_DEBUG << "ELF file has been processed by interrupted run, skipping:" << job.path << std::endl;
+                                journal->elfProcessingCompleted(job.path);
+                                skippedFiles++;
+                                continue;
+                            }
+
+                            elfJobs.push_back(job);
+                        }
+
+                        stripOperations.clear();
+                        setElfRPathOperations.clear();
+
+                        eliminateNoOpElfOperations(elfJobs);
+
+                        // files which don't have to be modified after all can be hardlinked
+                        std::set<bf::path> modifiedFiles;
+                        for (const auto& job : elfJobs) {
+                            if ((job.strip && !job.alreadyStripped) || (job.setRPath && !job.rpathAlreadySet))
+                                modifiedFiles.insert(job.path);
+                        }
+
+                        for (auto& job : copyJobs)
+                            job.modified = modifiedFiles.find(job.to) != modifiedFiles.end();
+
+                        // the ELF files which are copied in this run are processed once they have been copied
+                        std::map<bf::path, const ElfJob*> elfJobsAfterCopy;
+                        for (const auto& job : elfJobs) {
+                            if (!job.sourcePath.empty())
+                                elfJobsAfterCopy[job.path] = &job;
+                        }
+
+                        // the results are collected and reported once all files have been processed
+                        std::mutex resultsMutex;
+                        std::vector<bf::path> copiedFiles;
+                        std::vector<std::string> errors;
+                        uint64_t totalBytesRemoved = 0;
+
+                        const bool tryReflink = linkMode == LINK_MODE_AUTO || linkMode == LINK_MODE_REFLINK;
+                        const bool tryHardlink = linkMode == LINK_MODE_AUTO || linkMode == LINK_MODE_HARDLINK;
+
+                        size_t reflinkedFiles = 0;
+                        size_t hardlinkedFiles = 0;
+
+                        // ELF files which have been stripped while copying them
+                        size_t transformedCopies = 0;
+
+                        // patchelf is only needed if the new rpath doesn't fit into the files, which is worth
+                        // reporting
+                        size_t rpathsUpdatedInPlace = 0;
+                        size_t rpathsUpdatedWithPatchelf = 0;
+
+                        // the threads are split between the lanes, each lane needs at least one thread, though
+                        const auto threadCount = jobs > 0 ? jobs : util::threadpool::ThreadPool::defaultThreadCount();
+                        const auto ioThreadCount = std::max<size_t>(threadCount / 2, 1);
+                        const auto cpuThreadCount = std::max<size_t>(threadCount - ioThreadCount, 1);
+
+                        {
+                            // the CPU lane must outlive the I/O lane, whose tasks submit tasks to it
+                            util::threadpool::ThreadPool cpuLane(cpuThreadCount);
+                            util::threadpool::ThreadPool ioLane(ioThreadCount);
+
+                            ldLog() << "Copying" << copyJobs.size() << "files and processing" << elfJobs.size() << "ELF files using"
+                                    << ioLane.threadCount() << "I/O threads and" << cpuLane.threadCount() << "CPU threads" << std::endl;
+
+                            auto addError = [&](const ElfJob& job, const std::string& message) {
+                                if (manifest != nullptr)
+                                    manifest->remove(job.path);
+
+                                std::lock_guard<std::mutex> lock(resultsMutex);
+                                errors.push_back(message);
+                            };
+
+                            // apply the transformations which haven't been applied while copying the file
+                            auto processElfFile = [&](const ElfJob& job, bool stripped, bool rpathSet) {
+                                const auto& filePath = job.path;
+
+                                try {
+                                    const bool stripFile = job.strip && !job.alreadyStripped && !stripped;
+                                    const bool setRPath = job.setRPath && !job.rpathAlreadySet && !rpathSet;
+
+                                    if (stripFile || setRPath) {
+                                        elf::ElfFile file(filePath);
+
+                                        if (stripFile) {
+                                            ldLog() << "Stripping ELF file" << filePath << std::endl;
+
+                                            uint64_t bytesRemoved = 0;
+
+                                            if (!file.strip(&bytesRemoved)) {
+                                                addError(job, "Failed to strip ELF file: " + filePath.string());
+                                                return;
+                                            }
+
+                                            if (!job.sourcePath.empty() && cache != nullptr)
+                                                cache->setStripped(job.sourcePath, bytesRemoved == 0);
+
+                                            std::lock_guard<std::mutex> lock(resultsMutex);
+                                            totalBytesRemoved += bytesRemoved;
+                                        }
+
+                                        if (setRPath) {
+                                            ldLog() << "Setting rpath in ELF file" << filePath << "to" << job.rpath << std::endl;
+
+                                            elf::RPathUpdateMethod method;
+
+                                            if (!file.setRPath(job.rpath, &method)) {
+                                                addError(job, "Failed to set rpath in ELF file: " + filePath.string());
+                                                return;
+                                            }
+
+                                            if (method == elf::RPATH_UPDATED_WITH_PATCHELF)
+                                                ldLog() << LD_DEBUG << "rpath did not fit into ELF file, used patchelf:" << filePath << std::endl;
+
+                                            std::lock_guard<std::mutex> lock(resultsMutex);
+
+                                            if (method == elf::RPATH_UPDATED_IN_PLACE)
+                                                rpathsUpdatedInPlace++;
+                                            else
+                                                rpathsUpdatedWithPatchelf++;
+                                        }
+                                    }
+
+                                    if (manifest != nullptr)
+                                        manifest->update(filePath, job.sourcePath, job.strip, job.setRPath, job.rpath);
+
+                                    journal->elfProcessingCompleted(filePath);
+                                } catch (const std::exception& e) {
+                                    addError(job, "Failed to process ELF file " + filePath.string() + ": " + e.what());
+                                }
+                            };
+
+                            // stripping rewrites the entire file, therefore files which are going to be stripped are
+                            // written stripped right away, and get their new rpath in the same pass if it fits into the
+                            // file
+                            // returns false if the file couldn't be written, the caller should fall back to copying it
+                            auto copyAndTransformElfFile = [&](const CopyJob& copyJob, const ElfJob& job, bool& rpathSet) {
+                                uint64_t bytesRemoved = 0;
+
+                                try {
+                                    elf::ElfFile source(copyJob.from);
+
+                                    ldLog() << "Copying and stripping ELF file" << copyJob.from << "to" << copyJob.to << std::endl;
+
+                                    if (!source.writeTransformedCopy(copyJob.to, true, job.setRPath, job.rpath, &rpathSet, &bytesRemoved))
+                                        return false;
+                                } catch (const std::exception& e) {
+                                    ldLog() << LD_DEBUG << "Could not read ELF file" << copyJob.from << LD_NO_SPACE << ":" << e.what() << std::endl;
+                                    return false;
+                                }
+
+                                struct stat statData{};
+
+                                if (copyJob.makeExecutable && stat(copyJob.to.c_str(), &statData) == 0)
+                                    chmod(copyJob.to.c_str(), statData.st_mode | ((statData.st_mode & 0444) >> 2));
+
+                                if (cache != nullptr)
+                                    cache->setStripped(copyJob.from, bytesRemoved == 0);
+
+                                std::lock_guard<std::mutex> lock(resultsMutex);
+
+                                totalBytesRemoved += bytesRemoved;
+                                transformedCopies++;
+
+                                if (rpathSet) {
+                                    ldLog() << LD_DEBUG << "Set rpath while copying ELF file:" << copyJob.to << std::endl;
+                                    rpathsUpdatedInPlace++;
+                                }
+
+                                return true;
+                            };
+
+                            // the files which aren't copied can be processed right away
+                            for (const auto& job : elfJobs) {
+                                if (job.sourcePath.empty())
+                                    cpuLane.submit([&, job]() { processElfFile(job, false, false); });
+                            }
+
+                            for (const auto& job : copyJobs) {
+                                ioLane.submit([&, job]() {
+                                    bool reflinked = false;
+                                    bool hardlinked = false;
+                                    bool copied = false;
+
+                                    // the ELF file which is going to be processed after copying it, if any
+                                    const auto elfJobIt = elfJobsAfterCopy.find(job.to);
+                                    const ElfJob* elfJob = elfJobIt != elfJobsAfterCopy.end() ? elfJobIt->second : nullptr;
+
+                                    bool stripped = false;
+                                    bool rpathSet = false;
+
+                                    // the old file might be a hardlink, which must not be written to
+                                    if (job.replace)
+                                        unlink(job.to.c_str());
+
+                                    if (elfJob != nullptr && elfJob->strip && !elfJob->alreadyStripped) {
+                                        stripped = copyAndTransformElfFile(job, *elfJob, rpathSet);
+                                        copied = stripped;
+
+                                        if (!stripped)
+                                            ldLog() << LD_DEBUG << "Falling back to copying and stripping ELF file separately:" << job.to << std::endl;
+                                    }
+
+                                    if (!copied && tryReflink)
+                                        reflinked = reflinkFile(job.from, job.to, job.makeExecutable);
+
+                                    // hardlinks share the permissions with the source file, too
+                                    if (!copied && !reflinked && tryHardlink && !job.modified && !job.makeExecutable)
+                                        hardlinked = linkat(AT_FDCWD, job.from.c_str(), AT_FDCWD, job.to.c_str(), AT_SYMLINK_FOLLOW) == 0;
+
+                                    if (!copied && !reflinked && !hardlinked)
+                                        copied = copyFileData(job.from, job.to, job.makeExecutable);
+
+                                    // files which are going to be modified are recorded once they have been processed
+                                    if (manifest != nullptr && !job.modified) {
+                                        if (reflinked || hardlinked || copied)
+                                            manifest->update(job.to, job.from, false, false, "");
+                                        else
+                                            manifest->remove(job.to);
+                                    }
+
+                                    {
+                                        std::lock_guard<std::mutex> lock(resultsMutex);
+
+                                        if (reflinked)
+                                            reflinkedFiles++;
+
+                                        if (hardlinked)
+                                            hardlinkedFiles++;
+
+                                        if (!reflinked && !hardlinked && !copied) {
+                                            success = false;
+                                            return;
+                                        }
+
+                                        copiedFiles.push_back(job.to);
+                                    }
+
+                                    journal->copyCompleted(job.to);
+
+                                    if (elfJob == nullptr)
+                                        return;
+
+                                    // there's nothing left to do if all the transformations have been applied while copying
+                                    if ((stripped || !elfJob->strip || elfJob->alreadyStripped) &&
+                                        (rpathSet || !elfJob->setRPath || elfJob->rpathAlreadySet)) {
+                                        processElfFile(*elfJob, stripped, rpathSet);
+                                        return;
+                                    }
+
+                                    // hand the file over to the next stage
+                                    const auto& nextJob = *elfJob;
+                                    cpuLane.submit([&, nextJob, stripped, rpathSet]() { processElfFile(nextJob, stripped, rpathSet); });
+                                });
+                            }
+
+                            // the CPU lane receives new tasks until all the copies have completed
+                            ioLane.wait();
+                            cpuLane.wait();
+                        }
+
+                        for (const auto& path : copiedFiles)
+                            index->addFile(path);
+
+                        if (!executeSymlinkOperations())
+                            success = false;
+
+                        // the files deployed so far won't be needed anymore, their mappings can be released
+                        elf::ElfFile::clearRegistry();
+
+                        if (linkMode != LINK_MODE_COPY) {
+                            ldLog() << "Reflinked" << reflinkedFiles << "files, hardlinked" << hardlinkedFiles << "files, copied"
+                                    << (copiedFiles.size() - reflinkedFiles - hardlinkedFiles) << "files" << std::endl;
+                        }
+
+                        if (transformedCopies > 0)
+                            ldLog() << "Stripped" << transformedCopies << "ELF files while copying them" << std::endl;
+
+                        if (strip)
+                            ldLog() << "Stripping removed" << std::to_string(totalBytesRemoved) << "bytes in total" << std::endl;
+
+                        if (rpathsUpdatedInPlace > 0 || rpathsUpdatedWithPatchelf > 0) {
+                            ldLog() << "Updated rpath in" << rpathsUpdatedInPlace << "files in place and in"
+                                    << rpathsUpdatedWithPatchelf << "files using patchelf" << std::endl;
+                        }
 
-                                if (util::stringStartsWith(elf::ElfFile(filePath).getRPath(), "$")) {
-                                    ldLog() << LD_WARNING << "Not calling strip on binary" << filePath << LD_NO_SPACE
-                                            << ": rpath starts with $" << std::endl;
-                                } else {
-                                    ldLog() << "Calling strip on library" << filePath << std::endl;
+                        if (skippedFiles > 0)
+                            ldLog() << "Skipped" << skippedFiles << "ELF files which are up to date" << std::endl;
 
-                                    std::map<std::string, std::string> env;
-                                    env.insert(std::make_pair(std::string("LC_ALL"), std::string("C")));
+                        if (manifest != nullptr)
+                            manifest->save();
 
-                                    subprocess::Popen proc(
-                                        {getStripPath().c_str(), filePath.c_str()},
-                                        subprocess::output(subprocess::PIPE),
-                                        subprocess::error(subprocess::PIPE),
-                                        subprocess::environment(env)
-                                    );
+                        if (cache != nullptr) {
+                            ldLog() << "Metadata cache:" << cache->hits() << "hits," << cache->misses() << "misses" << std::endl;
+                            cache->save();
+                        }
 
-                                    std::string err = proc.communicate().second.buf.data();
+                        if (!errors.empty()) {
+                            ldLog() << LD_ERROR << "Failed to process" << errors.size() << "ELF files:" << std::endl;
 
-                                    if (proc.retcode() != 0 &&
-                                        !util::stringContains(err, "Not enough room for program headers")) {
-                                        ldLog() << LD_ERROR << "Strip call failed:" << err << std::endl;
-                                        success = false;
-                                    }
-                                }
+                            for (const auto& error : errors)
+                                ldLog() << LD_ERROR << error << std::endl;
 
-                                stripOperations.erase(stripOperations.begin());
-                            }
+                            return false;
                         }
 
                         if (!success)
                             return false;
 
-                        while (!setElfRPathOperations.empty()) {
-                            const auto& currentEntry = *(setElfRPathOperations.begin());
-                            const auto& filePath = currentEntry.first;
-                            const auto& rpath = currentEntry.second;
-
-                            ldLog() << "Setting rpath in ELF file" << filePath << "to" << rpath << std::endl;
-                            if (!elf::ElfFile(filePath).setRPath(rpath)) {
-                                ldLog() << LD_ERROR << "Failed to set rpath in ELF file:" << filePath << std::endl;
-                                success = false;
-                            }
-
-                            setElfRPathOperations.erase(setElfRPathOperations.begin());
-                        }
+                        journal->finish();
 
                         return true;
                     }
 
                     // search for copyright file related to given file
-                    // this function utilizes distribution tools like dpkg-query to determine the paths of copyright
-                    // files
+                    // the package the file belongs to is looked up in the index of the dpkg database, the copyright
+                    // file is the one that package installs in /usr/share/doc
                     std::vector<bf::path> searchForCopyrightFiles(const bf::path& from) {
-                        auto check_command = [](const std::string& command) {
-                            auto p = subprocess::Popen(
-                                command,
-                                subprocess::output(subprocess::PIPE),
-                                subprocess::error(subprocess::PIPE)
-                            );
-
-                            return p.wait();
-                        };
-
                         // cannot deploy copyright files for files in AppDir
                         if (!util::stringStartsWith(bf::absolute(from).string(), bf::absolute(appDirPath).string())) {
-                            if (check_command("which dpkg-query") == 0) {
-                                ldLog() << LD_DEBUG << "Using dpkg-query to search for copyright files" << std::endl;
-
-                                auto call = [](const std::initializer_list<const char*>& args) {
-                                    auto proc = subprocess::Popen(
-                                        args,
-                                        subprocess::output(subprocess::PIPE),
-                                        subprocess::error(subprocess::PIPE)
-                                    );
-
-                                    auto output = proc.communicate();
-                                    return std::make_pair(proc.retcode(), output.first);
-                                };
-
-                                auto dpkgQueryPackages = call({"dpkg-query", "-S", from.c_str()});
-
-                                if (dpkgQueryPackages.first != 0
-                                    || dpkgQueryPackages.second.buf.empty()
-                                    || dpkgQueryPackages.second.buf.front() == '\0') {
-                                    ldLog() << LD_WARNING << "Could not find copyright files for file" << from << "using dpkg-query" << std::endl;
-                                    return {};
-                                }
+                            if (packageIndex->isAvailable()) {
+                                ldLog() << LD_DEBUG << "Using dpkg database to search for copyright files" << std::endl;
 
-                                auto packageName = util::split(util::splitLines(dpkgQueryPackages.second.buf.data())[0], ':')[0];
+                                std::string packageName;
 
-                                if (!packageName.empty()) {
+                                if (!packageIndex->findPackage(from, packageName) || packageName.empty()) {
+                                    ldLog() << LD_WARNING << "Could not find copyright files for file" << from << "using dpkg database" << std::endl;
+                                    return {};
+                                }
 
-                                    auto copyrightFilePath = bf::path("/usr/share/doc") / packageName / "copyright";
+                                auto copyrightFilePath = packageindex::PackageIndex::getCopyrightFilePath(packageName);
 
-                                    if (bf::is_regular_file(copyrightFilePath)) {
-                                        return {copyrightFilePath};
-                                    }
-                                } else {
-                                    ldLog() << LD_WARNING << "Could not find copyright files for file" << from << "using dpkg-query" << std::endl;
+                                if (bf::is_regular_file(copyrightFilePath)) {
+                                    return {copyrightFilePath};
                                 }
                             }
                         } else {
                             ldLog() << LD_DEBUG << "Cannot deploy copyright files for files in AppDir:" << from << std::endl;
                         }
 
-                        ldLog() << LD_DEBUG << "Could not find suitable tool for copyright files deployment, skipping" << from << std::endl;
+                        ldLog() << LD_DEBUG << "Could not find copyright files in dpkg database, skipping" << from << std::endl;
 
                         return {};
                     }
@@ -265,12 +1198,24 @@ namespace linuxdeploy {
                     bool deployCopyrightFiles(const bf::path& from, const std::string& logPrefix = "") {
                         ldLog() << logPrefix << LD_NO_SPACE << "Deploying copyright files for file" << from << std::endl;
 
-                        auto copyrightFiles = searchForCopyrightFiles(from);
+                        std::vector<bf::path> copyrightFiles;
+
+                        if (cache == nullptr || !cache->getCopyrightFiles(from, copyrightFiles)) {
+                            copyrightFiles = searchForCopyrightFiles(from);
+
+                            if (cache != nullptr)
+                                cache->setCopyrightFiles(from, copyrightFiles);
+                        }
 
                         if (copyrightFiles.empty())
                             return false;
 
                         for (const auto& file : copyrightFiles) {
+                            // many of the deployed files belong to the same package, its copyright file needs to be
+                            // copied once only
+                            if (hasBeenVisitedAlready(file))
+                                continue;
+
                             std::string targetDir = file.string();
                             targetDir.erase(0, 1);
                             deployFile(file, appDirPath / targetDir);
@@ -282,7 +1227,8 @@ namespace linuxdeploy {
                     // register copy operation that will be executed later
                     // by compiling a list of files to copy instead of just copying everything, one can ensure that
                     // the files are touched once only
-                    void deployFile(const bf::path& from, bf::path to, bool verbose = false) {
+                    // returns the destination path of the file
+                    bf::path deployFile(const bf::path& from, bf::path to, bool verbose = false) {
                         if (verbose)
                             ldLog() << "Deploying file" << from << "to" << to << std::endl;
 
@@ -291,10 +1237,21 @@ namespace linuxdeploy {
                             to /= from.filename();
                         }
 
-                        copyOperations[from] = to;
+                        if (deployAlias(from, to))
+                            return to;
+
+                        const auto fromId = paths.intern(from);
+                        const auto toId = paths.intern(to);
+                        copyOperations[fromId] = toId;
 
                         // mark file as visited
-                        visitedFiles.insert(from);
+                        visitedFiles.insert(fromId);
+
+                        FileId fileId;
+                        if (getFileId(from, fileId))
+                            fileDestinations.insert(std::make_pair(fileId, toId));
+
+                        return to;
                     }
 
                     std::string getLogPrefix(int recursionLevel) {
@@ -304,13 +1261,123 @@ namespace linuxdeploy {
                         return logPrefix;
                     }
 
-                    bool deployElfDependencies(const bf::path& path, int recursionLevel = 0) {
+                    // resolve the direct dependencies of a file, or look them up in the cache
+                    // may be called from multiple threads at the same time
+                    DependencyNode resolveDependencyNode(const bf::path& path, const std::vector<std::string>& loaderRPathDirectories) {
+                        DependencyNode node;
+
+                        if (cache == nullptr || !cache->getDependencies(path, loaderRPathDirectories, node.dependencies, node.rpathDirectories)) {
+                            elf::ElfFile file(path);
+                            node.dependencies = file.resolveNeededLibraries(loaderRPathDirectories, &node.rpathDirectories);
+
+                            if (cache != nullptr)
+                                cache->setDependencies(path, loaderRPathDirectories, node.dependencies, node.rpathDirectories);
+                        }
+
+                        return node;
+                    }
+
+                    // look up the node of a file in the dependency graph, resolving its direct dependencies if necessary
+                    // the DT_RPATH directories inherited from the loading files are taken from the first file that
+                    // depends on the file
+                    const DependencyNode& getDependencyNode(const bf::path& path, const std::vector<std::string>& loaderRPathDirectories) {
+                        FileId fileId;
+
+                        if (!getFileId(path, fileId))
+                            throw elf::ElfFileParseError("No such file or directory: " + path.string());
+
+                        auto it = dependencyGraph.find(fileId);
+
+                        if (it == dependencyGraph.end()) {
+                            DependencyNode node;
+                            bool resolved = false;
+
+                            {
+                                std::lock_guard<std::mutex> lock(resolvedNodesMutex);
+                                auto resolvedIt = resolvedNodes.find(std::make_pair(fileId, loaderRPathDirectories));
+
+                                if (resolvedIt != resolvedNodes.end()) {
+                                    node = std::move(resolvedIt->second);
+                                    resolvedNodes.erase(resolvedIt);
+                                    resolved = true;
+                                }
+                            }
+
+                            if (!resolved)
+                                node = resolveDependencyNode(path, loaderRPathDirectories);
+
+                            it = dependencyGraph.insert(std::make_pair(fileId, std::move(node))).first;
+                        }
+
+                        return it->second;
+                    }
+
+                    // resolve the dependency trees of the given ELF files in parallel
+                    // the deploy functions use the results, but still visit the files in the same order as if they
+                    // hadn't been resolved ahead of time, so the result of the deployment doesn't change
+                    // errors are ignored here, they are reported when the files are deployed
+                    void resolveDependencies(const std::vector<bf::path>& paths) {
+                        // files are identified by device and inode, so that files reachable via multiple paths (e.g.,
+                        // through symlinked directories) are resolved once only
+                        std::set<std::pair<FileId, std::vector<std::string>>> visited;
+                        std::mutex visitedMutex;
+
+                        util::threadpool::ThreadPool pool(jobs);
+
+                        ldLog() << LD_DEBUG << "Resolving dependencies of" << paths.size() << "ELF files using" << pool.threadCount() << "threads" << std::endl;
+
+                        std::function<void(const bf::path&, const std::vector<std::string>&)> visit;
+
+                        visit = [&](const bf::path& path, const std::vector<std::string>& loaderRPathDirectories) {
+                            FileId fileId;
+
+                            if (!getFileId(path, fileId))
+                                return;
+
+                            const auto key = std::make_pair(fileId, loaderRPathDirectories);
+
+                            {
+                                std::lock_guard<std::mutex> lock(visitedMutex);
+
+                                if (!visited.insert(key).second)
+                                    return;
+                            }
+
+                            DependencyNode node;
+
+                            try {
+                                node = resolveDependencyNode(path, loaderRPathDirectories);
+                            } catch (const std::exception&) {
+                                return;
+                            }
+
+                            const auto& rpathDirectories = node.rpathDirectories;
+
+                            for (const auto& dependencyPath : node.dependencies) {
+                                pool.submit([&visit, dependencyPath, rpathDirectories]() { visit(dependencyPath, rpathDirectories); });
+                            }
+
+                            std::lock_guard<std::mutex> lock(resolvedNodesMutex);
+                            resolvedNodes.insert(std::make_pair(key, std::move(node)));
+                        };
+
+                        for (const auto& path : paths)
+                            pool.submit([&visit, path]() { visit(path, {}); });
+
+                        pool.wait();
+                    }
+
+                    bool deployElfDependencies(const bf::path& path, int recursionLevel = 0, const std::vector<std::string>& loaderRPathDirectories = {}) {
                         auto logPrefix = getLogPrefix(recursionLevel);
 
                         ldLog() << logPrefix << LD_NO_SPACE << "Deploying dependencies for ELF file" << path << std::endl;
                         try {
-                            for (const auto &dependencyPath : elf::ElfFile(path).traceDynamicDependencies()) {
-                                if (!deployLibrary(dependencyPath, recursionLevel + 1))
+                            // the nodes are never removed from the graph, therefore the reference remains valid while
+                            // the dependencies are deployed
+                            const auto& node = getDependencyNode(path, loaderRPathDirectories);
+
+                            for (const auto& dependencyPath : node.dependencies) {
+                                if (!deployLibrary(dependencyPath, recursionLevel + 1, false, bf::path(), node.rpathDirectories))
                                     return false;
                             }
                         } catch (const elf::DependencyNotFoundError& e) {
@@ -321,23 +1388,8 @@ namespace linuxdeploy {
                         return true;
                     }
 
-                    static std::string getStripPath() {
-                        // by default, try to use a patchelf next to the linuxdeploy binary
-                        // if that isn't available, fall back to searching for patchelf in the PATH
-                        std::string patchelfPath = "strip";
-
-                        auto binDirPath = bf::path(util::getOwnExecutablePath());
-                        auto localStripPath = binDirPath.parent_path() / "strip";
-
-                        if (bf::exists(localStripPath))
-                            patchelfPath = localStripPath.string();
-
-                        ldLog() << LD_DEBUG << "Using strip:" << patchelfPath << std::endl;
-
-                        return patchelfPath;
-                    }
-
-                    bool deployLibrary(const bf::path& path, int recursionLevel = 0, bool forceDeploy = false,const bf::path &destination = bf::path()) {
+                    bool deployLibrary(const bf::path& path, int recursionLevel = 0, bool forceDeploy = false, const bf::path& destination = bf::path(),
+                                       const std::vector<std::string>& loaderRPathDirectories = {}) {
                         auto logPrefix = getLogPrefix(recursionLevel);
 
                         if (!forceDeploy && hasBeenVisitedAlready(path)) {
@@ -345,42 +1397,17 @@ namespace linuxdeploy {
                             return true;
                         }
 
-
-                        static auto isInExcludelist = [&logPrefix](const bf::path& fileName) {
-                            for (const auto& excludePattern : generatedExcludelist) {
-                                // simple string match is faster than using fnmatch
-                                if (excludePattern == fileName)
-                                    return true;
-
-                                auto fnmatchResult = fnmatch(excludePattern.c_str(), fileName.string().c_str(), FNM_PATHNAME);
-                                switch (fnmatchResult) {
-                                    case 0:
-                                        return true;
-                                    case FNM_NOMATCH:
-                                        break;
-                                    default:
-                                        ldLog() << LD_ERROR << logPrefix << LD_NO_SPACE << "fnmatch() reported error:" << fnmatchResult << std::endl;
-                                        return false;
-                                }
-                            }
-
-                            return false;
-                        };
-
-                        if (!forceDeploy && isInExcludelist(path.filename())) {
+                        if (!forceDeploy && excludelist.matches(path.filename().string())) {
                             ldLog() << logPrefix << LD_NO_SPACE << "Skipping deployment of blacklisted library" << path << std::endl;
 
                             // mark file as visited
-                            visitedFiles.insert(path);
+                            visitedFiles.insert(paths.intern(path));
 
-                            return true;
+                            // the dependencies of blacklisted libraries may not be blacklisted themselves, and have to
+                            // be deployed anyway
+                            return deployElfDependencies(path, recursionLevel, loaderRPathDirectories);
                         }
 
-                        ldLog() << logPrefix << LD_NO_SPACE << "Deploying shared library" << path;
-                        if (!destination.empty())
-                            ldLog() << " (destination:" << destination << LD_NO_SPACE << ")";
-                        ldLog() << std::endl;
-
                         auto destinationPath = destination.empty() ? appDirPath / "usr/lib/" : destination;
 
                         // not sure whether this is 100% bullet proof, but it simulates the cp command behavior
@@ -388,6 +1415,14 @@ namespace linuxdeploy {
                             destinationPath /= path.filename();
                         }
 
+                        // the copy's rpath is set, and its dependencies are deployed already
+                        if (deployAlias(path, destinationPath, logPrefix))
+                            return true;
+
+                        ldLog() << logPrefix << LD_NO_SPACE << "Deploying shared library" << path;
+                        if (!destination.empty())
+                            ldLog() << " (destination:" << destination << LD_NO_SPACE << ")";
+                        ldLog() << std::endl;
 
                         deployFile(path, destinationPath);
                         deployCopyrightFiles(path, logPrefix);
@@ -411,10 +1446,10 @@ namespace linuxdeploy {
                         }
 
 
-                        setElfRPathOperations[destinationPath] = rpath;
-                        stripOperations.insert(destinationPath);
+                        addSetRPathOperation(destinationPath, rpath);
+                        addStripOperation(destinationPath);
 
-                        if (!deployElfDependencies(path, recursionLevel))
+                        if (!deployElfDependencies(path, recursionLevel, loaderRPathDirectories))
                             return false;
 
                         return true;
@@ -426,13 +1461,14 @@ namespace linuxdeploy {
                             return true;
                         }
 
-                        ldLog() << "Deploying executable" << path << std::endl;
+                        auto destinationPath = destination.empty() ? appDirPath / "usr/bin/" : destination;
 
-                        // FIXME: make executables executable
+                        if (deployAlias(path, destinationPath / path.filename()))
+                            return true;
 
-                        auto destinationPath = destination.empty() ? appDirPath / "usr/bin/" : destination;
+                        ldLog() << "Deploying executable" << path << std::endl;
 
-                        deployFile(path, destinationPath);
+                        executableFiles.insert(paths.intern(deployFile(path, destinationPath)));
                         deployCopyrightFiles(path);
 
                         std::string rpath = "$ORIGIN/../lib";
@@ -453,8 +1489,8 @@ namespace linuxdeploy {
                             rpath = "$ORIGIN/" + relPath.string();
                         }
 
-                        setElfRPathOperations[destinationPath / path.filename()] = rpath;
-                        stripOperations.insert(destinationPath / path.filename());
+                        addSetRPathOperation(destinationPath / path.filename(), rpath);
+                        addStripOperation(destinationPath / path.filename());
 
                         if (!deployElfDependencies(path))
                             return false;
@@ -554,6 +1590,8 @@ namespace linuxdeploy {
                 d = new PrivateData();
 
                 d->appDirPath = path;
+                d->index.reset(new appdirindex::AppDirIndex(path));
+                d->journal.reset(new appdirjournal::AppDirJournal(path));
             }
 
             AppDir::~AppDir() {
@@ -623,53 +1661,18 @@ namespace linuxdeploy {
                 return d->appDirPath;
             }
 
-            static std::vector<bf::path> listFilesInDirectory(const bf::path& path, const bool recursive = true) {
-                std::vector<bf::path> foundPaths;
-
-                // directory_iterators throw exceptions if the directory doesn't exist
-                if (!bf::is_directory(path)) {
-                    ldLog() << LD_DEBUG << "No such directory:" << path << std::endl;
-                    return {};
-                }
-
-                if (recursive) {
-                    for (bf::recursive_directory_iterator i(path); i != bf::recursive_directory_iterator(); ++i) {
-                        if (bf::is_regular_file(*i)) {
-                            foundPaths.push_back((*i).path());
-                        }
-                    }
-                } else {
-                    for (bf::directory_iterator i(path); i != bf::directory_iterator(); ++i) {
-                        if (bf::is_regular_file(*i)) {
-                            foundPaths.push_back((*i).path());
-                        }
-                    }
-                }
-
-                return foundPaths;
-            }
-
             std::vector<bf::path> AppDir::deployedIconPaths() {
-                auto icons = listFilesInDirectory(path() / "usr/share/icons/");
-                auto pixmaps = listFilesInDirectory(path() / "usr/share/pixmaps/", false);
-                icons.reserve(pixmaps.size());
-                std::copy(pixmaps.begin(), pixmaps.end(), std::back_inserter(icons));
-                return icons;
+                return d->index->files(appdirindex::FILE_KIND_ICON);
             }
 
             std::vector<bf::path> AppDir::deployedExecutablePaths() {
-                return listFilesInDirectory(path() / "usr/bin/", false);
+                return d->index->files(appdirindex::FILE_KIND_EXECUTABLE);
             }
 
             std::vector<desktopfile::DesktopFile> AppDir::deployedDesktopFiles() {
                 std::vector<desktopfile::DesktopFile> desktopFiles;
 
-                auto paths = listFilesInDirectory(path() / "usr/share/applications/", false);
-                paths.erase(std::remove_if(paths.begin(), paths.end(), [](const bf::path& path) {
-                    return path.extension() != ".desktop";
-                }), paths.end());
-
-                for (const auto& path : paths) {
+                for (const auto& path : d->index->files(appdirindex::FILE_KIND_DESKTOP_FILE)) {
                     desktopFiles.push_back(desktopfile::DesktopFile(path));
                 }
 
@@ -695,13 +1698,14 @@ namespace linuxdeploy {
 
                 bool iconDeployed = false;
 
-                const auto foundIconPaths = deployedIconPaths();
-
-                if (foundIconPaths.empty()) {
+                if (deployedIconPaths().empty()) {
                     ldLog() << LD_ERROR << "Could not find icon executable for Icon entry:" << iconName << std::endl;
                     return false;
                 }
 
+                // the icons are looked up by their names, the first one found while walking the directories is used
+                const auto foundIconPaths = d->index->findByFilename(appdirindex::FILE_KIND_ICON, iconName, true);
+
                 for (const auto& iconPath : foundIconPaths) {
                     ldLog() << LD_DEBUG << "Icon found:" << iconPath << std::endl;
 
@@ -753,9 +1757,7 @@ namespace linuxdeploy {
 
                         executableName = util::split(executableName)[0];
 
-                        const auto foundExecutablePaths = deployedExecutablePaths();
-
-                        if (foundExecutablePaths.empty()) {
+                        if (deployedExecutablePaths().empty()) {
                             ldLog() << LD_ERROR << "Could not find suitable executable for Exec entry:" << executableName
                                     << std::endl;
                             return false;
@@ -763,6 +1765,8 @@ namespace linuxdeploy {
 
                         bool deployedExecutable = false;
 
+                        const auto foundExecutablePaths = d->index->findByFilename(appdirindex::FILE_KIND_EXECUTABLE, executableName);
+
                         for (const auto& executablePath : foundExecutablePaths) {
                             ldLog() << LD_DEBUG << "Executable found:" << executablePath << std::endl;
 
@@ -792,33 +1796,296 @@ namespace linuxdeploy {
                 return true;
             }
 
+            bool AppDir::createSymlink(const bf::path& target, const bf::path& symlink, bool useRelativePath) {
+                return d->symlinkFile(target, symlink, useRelativePath);
+            }
+
+            bool AppDir::createSymlinks(const std::vector<std::pair<bf::path, bf::path>>& links, bool useRelativePath) {
+                std::map<bf::path, bf::path> canonicalDirectories;
+
+                bool success = true;
+
+                for (const auto& link : links) {
+                    if (!d->symlinkFile(link.first, link.second, useRelativePath, canonicalDirectories))
+                        success = false;
+                }
+
+                return success;
+            }
+
             void AppDir::deployFile(const boost::filesystem::path& from, const boost::filesystem::path& to) {
-                return d->deployFile(from, to, true);
+                d->deployFile(from, to, true);
             }
 
             void AppDir::setAppName(const std::string& appName) {
                 d->appName = appName;
             }
 
-            std::vector<bf::path> AppDir::listExecutables() {
-                util::magic::Magic magic;
+            void AppDir::setJobs(size_t jobs) {
+                d->jobs = jobs;
+            }
 
-                std::vector<bf::path> executables;
+            void AppDir::setLinkMode(LinkMode linkMode) {
+                d->linkMode = linkMode;
+            }
+
+            void AppDir::setIncremental(bool incremental) {
+                if (!incremental) {
+                    d->manifest.reset();
+                    return;
+                }
 
-                for (const auto& file : listFilesInDirectory(path() / "usr" / "bin", false)) {
-                    auto fileType = magic.fileType(bf::absolute(file).string());
+                ldLog() << "Using manifest" << appdirmanifest::AppDirManifest::getManifestPath(d->appDirPath) << std::endl;
+                d->manifest.reset(new appdirmanifest::AppDirManifest(d->appDirPath));
+            }
 
-                    ldLog() << LD_DEBUG << "Type of file" << file << LD_NO_SPACE << ":" << fileType << std::endl;
+            void AppDir::setResume(bool resume) {
+                d->resume = resume;
 
-                    // make sure it's an ELF file
-                    try {
-                        elf::ElfFile elfFile(file);
-                    } catch (const elf::ElfFileParseError&) {
-                        // FIXME: remove this workaround once the MIME check below works as intended
+                // the journal has to be read before any files are deployed, as it is replaced by the new run's one
+                if (resume) {
+                    if (d->journal->loadPreviousRun()) {
+                        ldLog() << "Resuming interrupted run using journal" << appdirjournal::AppDirJournal::getJournalPath(d->appDirPath) << std::endl;
+
+                        const auto removedFiles = d->journal->removeTemporaryFiles();
+
+                        if (removedFiles > 0)
+                            ldLog() << "Removed" << removedFiles << "temporary files left behind by interrupted run" << std::endl;
+                    } else {
+                        ldLog() << LD_WARNING << "No journal of an interrupted run found, nothing to resume" << std::endl;
+                    }
+                }
+            }
+
+            void AppDir::setCacheDirectory(const bf::path& path) {
+                if (path.empty()) {
+                    d->cache.reset();
+                    return;
+                }
+
+                ldLog() << "Using metadata cache in" << path << std::endl;
+                d->cache.reset(new metadatacache::MetadataCache(path, d->packageIndex->getAdminDirectory()));
+            }
+
+            void AppDir::setPackageDatabaseDirectory(const bf::path& path) {
+                d->packageIndex.reset(new packageindex::PackageIndex(path));
+
+                // the cached copyright files belong to the previous database
+                if (d->cache != nullptr) {
+                    d->cache->save();
+                    d->cache.reset(new metadatacache::MetadataCache(d->cache->directory(), path));
+                }
+            }
+
+            void AppDir::addExcludedLibraryPattern(const std::string& pattern) {
+                d->excludelist.addPattern(pattern);
+            }
+
+            // compare the contents of two files byte by byte
+            static bool haveSameContents(const bf::path& a, const bf::path& b) {
+                std::ifstream ifsA(a.string(), std::ios::binary);
+                std::ifstream ifsB(b.string(), std::ios::binary);
+
+                if (!ifsA || !ifsB)
+                    return false;
+
+                std::vector<char> bufferA(64 * 1024), bufferB(64 * 1024);
+
+                while (true) {
+                    ifsA.read(bufferA.data(), bufferA.size());
+                    ifsB.read(bufferB.data(), bufferB.size());
+
+                    if (ifsA.gcount() != ifsB.gcount())
+                        return false;
+
+                    if (memcmp(bufferA.data(), bufferB.data(), static_cast<size_t>(ifsA.gcount())) != 0)
+                        return false;
+
+                    if (ifsA.eof() || ifsB.eof())
+                        return ifsA.eof() && ifsB.eof();
+
+                    if (!ifsA || !ifsB)
+                        return false;
+                }
+            }
+
+            bool AppDir::deduplicateFiles(DeduplicationMode mode) {
+                struct FileInfo {
+                    bf::path path;
+                    dev_t device;
+                    ino_t inode;
+                    off_t size;
+                    mode_t mode;
+                    uint64_t hash;
+                };
+
+                // files are grouped by size first, as only files of the same size can be identical
+                // files which are hardlinked already count as one file
+                std::map<off_t, std::vector<FileInfo>> filesBySize;
+                std::set<std::pair<dev_t, ino_t>> inodes;
+
+                const auto manifestPath = appdirmanifest::AppDirManifest::getManifestPath(path());
+
+                try {
+                    for (bf::recursive_directory_iterator i(path()); i != bf::recursive_directory_iterator(); ++i) {
+                        const auto& filePath = (*i).path();
+
+                        struct stat statData{};
+
+                        // symlinks are not followed
+                        if (lstat(filePath.c_str(), &statData) != 0 || !S_ISREG(statData.st_mode) || statData.st_size == 0)
+                            continue;
+
+                        if (filePath == manifestPath)
+                            continue;
+
+                        if (!inodes.insert(std::make_pair(statData.st_dev, statData.st_ino)).second)
+                            continue;
+
+                        filesBySize[statData.st_size].push_back({filePath, statData.st_dev, statData.st_ino, statData.st_size, statData.st_mode & 07777, 0});
+                    }
+                } catch (const bf::filesystem_error& e) {
+                    ldLog() << LD_ERROR << "Failed to list files in AppDir:" << e.what() << std::endl;
+                    return false;
+                }
+
+                std::vector<FileInfo*> candidates;
+
+                for (auto& pair : filesBySize) {
+                    if (pair.second.size() < 2)
                         continue;
+
+                    for (auto& file : pair.second)
+                        candidates.push_back(&file);
+                }
+
+                std::mutex resultsMutex;
+                bool success = true;
+
+                // the candidates are hashed in parallel, each task writes to its own FileInfo only
+                // the hashes only select candidates, which are compared byte by byte before they are deduplicated
+                {
+                    util::threadpool::ThreadPool pool(d->jobs);
+
+                    ldLog() << "Hashing" << candidates.size() << "candidates for deduplication using" << pool.threadCount() << "threads" << std::endl;
+
+                    for (auto* candidate : candidates) {
+                        pool.submit([&, candidate]() {
+                            if (!storage::hashFile(candidate->path, candidate->hash)) {
+                                ldLog() << LD_ERROR << "Failed to read file" << candidate->path << std::endl;
+
+                                std::lock_guard<std::mutex> lock(resultsMutex);
+                                success = false;
+                            }
+                        });
+                    }
+
+                    pool.wait();
+                }
+
+                if (!success)
+                    return false;
+
+                // files can only be replaced by files with the same permissions, otherwise the permissions would change
+                // the files are sorted by path, so that the same file is kept in every run
+                std::map<std::tuple<off_t, uint64_t, mode_t>, std::vector<const FileInfo*>> groups;
+
+                for (const auto* candidate : candidates)
+                    groups[std::make_tuple(candidate->size, candidate->hash, candidate->mode)].push_back(candidate);
+
+                size_t deduplicatedFiles = 0;
+                uint64_t bytesSaved = 0;
+
+                {
+                    util::threadpool::ThreadPool pool(d->jobs);
+
+                    for (auto& pair : groups) {
+                        auto& group = pair.second;
+
+                        if (group.size() < 2)
+                            continue;
+
+                        std::sort(group.begin(), group.end(), [](const FileInfo* a, const FileInfo* b) {
+                            return a->path < b->path;
+                        });
+
+                        pool.submit([&, group, mode]() {
+                            const auto& original = group.front()->path;
+
+                            for (size_t i = 1; i < group.size(); i++) {
+                                const auto& duplicate = group[i]->path;
+
+                                // hash collision
+                                if (!haveSameContents(original, duplicate))
+                                    continue;
+
+                                // the duplicate is replaced atomically, so it never disappears
+                                const auto temporaryPath = duplicate.string() + ".linuxdeploy-dedup." + std::to_string(getpid());
+
+                                int result;
+
+                                // executables resolve $ORIGIN via /proc/self/exe, i.e., relative to the target of a
+                                // symlink, therefore duplicates in other directories are hardlinked, so that their
+                                // $ORIGIN relative rpaths keep working
+                                if (mode == DEDUPLICATE_WITH_SYMLINKS && duplicate.parent_path() == original.parent_path()) {
+                                    result = symlink(original.filename().c_str(), temporaryPath.c_str());
+                                } else {
+                                    result = link(original.c_str(), temporaryPath.c_str());
+                                }
+
+                                if (result != 0 || rename(temporaryPath.c_str(), duplicate.c_str()) != 0) {
+                                    ldLog() << LD_ERROR << "Failed to replace duplicate file" << duplicate << "with link to" << original
+                                            << LD_NO_SPACE << ":" << strerror(errno) << std::endl;
+                                    unlink(temporaryPath.c_str());
+
+                                    std::lock_guard<std::mutex> lock(resultsMutex);
+                                    success = false;
+                                    continue;
+                                }
+
+                                ldLog() << LD_DEBUG << "Replaced duplicate file" << duplicate << "with link to" << original << std::endl;
+
+                                std::lock_guard<std::mutex> lock(resultsMutex);
+                                deduplicatedFiles++;
+                                bytesSaved += group[i]->size;
+                            }
+                        });
                     }
 
-//                    if (util::stringStartsWith(fileType, "application/x-executable"))
+                    pool.wait();
+                }
+
+                ldLog() << "Deduplicated" << deduplicatedFiles << "files, saved" << bytesSaved << "bytes" << std::endl;
+
+                return success;
+            }
+
+            // human readable description of ELF file types, used for log messages
+            static std::string describeElfFileType(elf::ElfFileType type) {
+                switch (type) {
+                    case elf::ELF_FILE_TYPE_EXECUTABLE:
+                        return "ELF executable";
+                    case elf::ELF_FILE_TYPE_PIE:
+                        return "ELF position independent executable";
+                    case elf::ELF_FILE_TYPE_SHARED_OBJECT:
+                        return "ELF shared object";
+                    case elf::ELF_FILE_TYPE_OTHER:
+                        return "other ELF file";
+                    default:
+                        return "not an ELF file";
+                }
+            }
+
+            std::vector<bf::path> AppDir::listExecutables() {
+                std::vector<bf::path> executables;
+
+                for (const auto& file : d->index->files(appdirindex::FILE_KIND_EXECUTABLE)) {
+                    const auto fileType = d->index->elfFileType(file);
+
+                    ldLog() << LD_DEBUG << "Type of file" << file << LD_NO_SPACE << ":" << describeElfFileType(fileType) << std::endl;
+
+                    // make sure it's an ELF file
+                    if (fileType != elf::ELF_FILE_TYPE_NONE)
                         executables.push_back(file);
                 }
 
@@ -826,43 +2093,81 @@ namespace linuxdeploy {
             }
 
             std::vector<bf::path> AppDir::listSharedLibraries() {
-                util::magic::Magic magic;
-
                 std::vector<bf::path> sharedLibraries;
 
-                for (const auto& file : listFilesInDirectory(path() / "usr" / "lib", true)) {
-                    auto fileType = magic.fileType(bf::absolute(file).string());
+                for (const auto& file : d->index->files(appdirindex::FILE_KIND_SHARED_LIBRARY)) {
+                    const auto fileType = d->index->elfFileType(file);
 
-                    ldLog() << LD_DEBUG << "Type of file" << file << LD_NO_SPACE << ":" << fileType << std::endl;
+                    ldLog() << LD_DEBUG << "Type of file" << file << LD_NO_SPACE << ":" << describeElfFileType(fileType) << std::endl;
 
                     // make sure it's an ELF file
-                    try {
-                        elf::ElfFile elfFile(file);
-                    } catch (const elf::ElfFileParseError&) {
-                        // FIXME: remove this workaround once the MIME check below works as intended
-                        continue;
-                    }
-
-//                    if (util::stringStartsWith(fileType, "application/x-sharedlib"))
+                    if (fileType != elf::ELF_FILE_TYPE_NONE)
                         sharedLibraries.push_back(file);
                 }
 
                 return sharedLibraries;
             }
 
+            void AppDir::resolveDependencies(const std::vector<bf::path>& paths) {
+                d->resolveDependencies(paths);
+            }
+
             bool AppDir::deployDependenciesForExistingFiles() {
-                for (const auto& executable : listExecutables()) {
+                // the files written by the interrupted run are deployed again when resuming it with the same
+                // arguments, along with their dependencies; they can't be parsed if they have been written partially,
+                // and their rpaths might have been set before their dependencies have been copied
+                auto removeFilesOfInterruptedRun = [this](std::vector<bf::path> files) {
+                    if (!d->resume)
+                        return files;
+
+                    files.erase(std::remove_if(files.begin(), files.end(), [this](const bf::path& file) {
+                        if (!d->journal->wasCopyPlanned(file))
+                            return false;
+
+                        ldLog() << LD_DEBUG << "File has been deployed by interrupted run, skipping:" << file << std::endl;
+                        return true;
+                    }), files.end());
+
+                    return files;
+                };
+
+                // symlinks (e.g., soname symlinks) and hardlinks refer to files which are listed already, every file is
+                // processed once only
+                std::set<PrivateData::FileId> fileIds;
+
+                auto removeAliases = [&fileIds](std::vector<bf::path> files) {
+                    files.erase(std::remove_if(files.begin(), files.end(), [&fileIds](const bf::path& file) {
+                        PrivateData::FileId fileId;
+
+                        if (!PrivateData::getFileId(file, fileId) || fileIds.insert(fileId).second)
+                            return false;
+
+                        ldLog() << LD_DEBUG << "File has been listed via another path already, skipping:" << file << std::endl;
+                        return true;
+                    }), files.end());
+
+                    return files;
+                };
+
+                const auto executables = removeAliases(removeFilesOfInterruptedRun(listExecutables()));
+                const auto sharedLibraries = removeAliases(removeFilesOfInterruptedRun(listSharedLibraries()));
+
+                std::vector<bf::path> paths(executables);
+                paths.insert(paths.end(), sharedLibraries.begin(), sharedLibraries.end());
+                d->resolveDependencies(paths);
+
+                for (const auto& executable : executables) {
                     if (!d->deployElfDependencies(executable))
                         return false;
 
-                    d->setElfRPathOperations[executable] = "$ORIGIN/../lib";
+                    d->addSetRPathOperation(executable, "$ORIGIN/../lib");
                 }
 
-                for (const auto& sharedLibrary : listSharedLibraries()) {
+                for (const auto& sharedLibrary : sharedLibraries) {
                     if (!d->deployElfDependencies(sharedLibrary))
                         return false;
 
-                    d->setElfRPathOperations[sharedLibrary] = "$ORIGIN";
+                    d->addSetRPathOperation(sharedLibrary, "$ORIGIN");
                 }
 
                 return true;
@@ -0,0 +1,389 @@
+// system headers
+#include <algorithm>
+#include <dirent.h>
+#include <functional>
+#include <map>
+#include <sys/stat.h>
+#include <unordered_map>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/appdirindex.h"
+#include "linuxdeploy/core/log.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirindex {
+            namespace {
+                const size_t FILE_KIND_COUNT = FILE_KIND_DESKTOP_FILE + 1;
+
+                // directories in which files are indexed, in the order they are walked
+                struct IndexedDirectory {
+                    const char* path;
+                    FileKind kind;
+                    bool recursive;
+                };
+
+                const IndexedDirectory INDEXED_DIRECTORIES[] = {
+                    {"usr/bin", FILE_KIND_EXECUTABLE, false},
+                    {"usr/lib", FILE_KIND_SHARED_LIBRARY, true},
+                    {"usr/share/icons", FILE_KIND_ICON, true},
+                    {"usr/share/pixmaps", FILE_KIND_ICON, false},
+                    {"usr/share/applications", FILE_KIND_DESKTOP_FILE, false},
+                };
+
+                bool sameModificationTime(const struct stat& a, const struct stat& b) {
+                    return a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+                }
+
+                // walk directory using the file types provided by readdir(), so that only symlinks (and files on file
+                // systems which don't provide the types) have to be stat()ed
+                // the callback for directories is called with the directory's stat data before its entries are walked
+                void walkDirectory(const bf::path& directory, bool recursive,
+                                   const std::function<void(const bf::path&)>& onFile,
+                                   const std::function<void(const bf::path&, const struct stat&)>& onDirectory) {
+                    auto* dir = opendir(directory.c_str());
+
+                    if (dir == nullptr) {
+                        ldLog() << LD_DEBUG << "No such directory:" << directory << std::endl;
+                        return;
+                    }
+
+                    struct stat statData{};
+
+                    if (fstat(dirfd(dir), &statData) == 0)
+                        onDirectory(directory, statData);
+
+                    struct dirent* entry;
+
+                    while ((entry = readdir(dir)) != nullptr) {
+                        const std::string name = entry->d_name;
+
+                        if (name == "." || name == "..")
+                            continue;
+
+                        const auto path = directory / name;
+
+                        auto type = entry->d_type;
+
+                        if (type == DT_UNKNOWN) {
+                            if (lstat(path.c_str(), &statData) != 0)
+                                continue;
+
+                            if (S_ISREG(statData.st_mode))
+                                type = DT_REG;
+                            else if (S_ISDIR(statData.st_mode))
+                                type = DT_DIR;
+                            else if (S_ISLNK(statData.st_mode))
+                                type = DT_LNK;
+                        }
+
+                        if (type == DT_REG) {
+                            onFile(path);
+                        } else if (type == DT_DIR) {
+                            if (recursive)
+                                walkDirectory(path, true, onFile, onDirectory);
+                        } else if (type == DT_LNK) {
+                            // symlinks to regular files are listed, symlinks to directories are not followed
+                            if (stat(path.c_str(), &statData) == 0 && S_ISREG(statData.st_mode))
+                                onFile(path);
+                        }
+                    }
+
+                    closedir(dir);
+                }
+
+                // paths are compared after making them absolute and removing redundant elements
+                std::string normalize(const bf::path& path) {
+                    return bf::absolute(path).lexically_normal().string();
+                }
+            }
+
+            class AppDirIndex::PrivateData {
+                public:
+                    struct Entry {
+                        bf::path path;
+                        FileKind kind;
+
+                        // the ELF file type is determined on demand
+                        bool elfFileTypeKnown;
+                        elf::ElfFileType elfFileType;
+                    };
+
+                    bf::path appDirPath;
+
+                    bool built;
+
+                    // all indexed files, in the order they have been found
+                    std::vector<Entry> entries;
+
+                    // lookup tables, storing positions in entries
+                    std::unordered_map<std::string, size_t> entriesByPath;
+                    std::vector<size_t> entriesByKind[FILE_KIND_COUNT];
+                    std::unordered_map<std::string, std::vector<size_t>> entriesByFilename[FILE_KIND_COUNT];
+                    std::unordered_map<std::string, std::vector<size_t>> entriesByStem[FILE_KIND_COUNT];
+
+                    // modification times of the walked directories, and of the indexed directories which didn't exist
+                    // (stored with a zero modification time)
+                    std::map<std::string, struct stat> directories;
+
+                public:
+                    explicit PrivateData(const bf::path& appDirPath) : appDirPath(appDirPath), built(false), entries(),
+                                                                       entriesByPath(), directories() {};
+
+                public:
+                    void clear() {
+                        built = false;
+                        entries.clear();
+                        entriesByPath.clear();
+                        directories.clear();
+
+                        for (size_t i = 0; i < FILE_KIND_COUNT; i++) {
+                            entriesByKind[i].clear();
+                            entriesByFilename[i].clear();
+                            entriesByStem[i].clear();
+                        }
+                    }
+
+                    void addEntry(const bf::path& path, FileKind kind) {
+                        const auto key = normalize(path);
+
+                        const auto it = entriesByPath.find(key);
+
+                        if (it != entriesByPath.end()) {
+                            // the file has been replaced
+                            entries[it->second].elfFileTypeKnown = false;
+                            return;
+                        }
+
+                        const auto position = entries.size();
+
+                        entries.push_back(Entry{path, kind, false, elf::ELF_FILE_TYPE_NONE});
+                        entriesByPath[key] = position;
+                        entriesByKind[kind].push_back(position);
+                        entriesByFilename[kind][path.filename().string()].push_back(position);
+                        entriesByStem[kind][path.stem().string()].push_back(position);
+                    }
+
+                    void recordDirectory(const bf::path& directory, const struct stat& statData) {
+                        directories[normalize(directory)] = statData;
+                    }
+
+                    void build() {
+                        clear();
+
+                        for (const auto& indexedDirectory : INDEXED_DIRECTORIES) {
+                            const auto directory = appDirPath / indexedDirectory.path;
+                            const auto kind = indexedDirectory.kind;
+
+                            // the directory might be created later on
+                            struct stat statData{};
+                            recordDirectory(directory, statData);
+
+                            walkDirectory(directory, indexedDirectory.recursive, [this, kind](const bf::path& path) {
+                                if (kind == FILE_KIND_DESKTOP_FILE && path.extension() != ".desktop")
+                                    return;
+
+                                addEntry(path, kind);
+                            }, [this](const bf::path& path, const struct stat& statData) {
+                                recordDirectory(path, statData);
+                            });
+                        }
+
+                        built = true;
+                    }
+
+                    // check whether any of the directories has been modified since it has been walked
+                    bool isUpToDate() {
+                        if (!built)
+                            return false;
+
+                        for (const auto& pair : directories) {
+                            struct stat statData{};
+
+                            if (stat(pair.first.c_str(), &statData) != 0)
+                                statData = {};
+
+                            if (!sameModificationTime(statData, pair.second))
+                                return false;
+                        }
+
+                        return true;
+                    }
+
+                    void update() {
+                        if (isUpToDate())
+                            return;
+
+                        ldLog() << LD_DEBUG << "Indexing files in AppDir" << appDirPath << std::endl;
+
+                        build();
+                    }
+
+                    bool isRecordedDirectory(const bf::path& directory) {
+                        return directories.find(normalize(directory)) != directories.end();
+                    }
+
+                    // check whether directory is a subdirectory of one of the directories which are walked recursively
+                    bool isInRecursiveDirectory(const bf::path& directory) {
+                        const auto relativePath = bf::path(normalize(directory)).lexically_relative(normalize(appDirPath)).string();
+
+                        for (const auto& indexedDirectory : INDEXED_DIRECTORIES) {
+                            const std::string prefix = std::string(indexedDirectory.path) + "/";
+
+                            if (indexedDirectory.recursive && relativePath.compare(0, prefix.size(), prefix) == 0)
+                                return true;
+                        }
+
+                        return false;
+                    }
+
+                    // determine the kind of a file by its location
+                    // returns false if the file is not located in one of the indexed directories
+                    bool classify(const bf::path& path, FileKind& kind) {
+                        const auto relativePath = bf::path(normalize(path)).lexically_relative(normalize(appDirPath));
+
+                        if (relativePath.empty() || *relativePath.begin() == "..")
+                            return false;
+
+                        for (const auto& indexedDirectory : INDEXED_DIRECTORIES) {
+                            const bf::path directory = indexedDirectory.path;
+
+                            const bool matches = indexedDirectory.recursive
+                                ? relativePath.string().compare(0, directory.string().size() + 1, directory.string() + "/") == 0
+                                : relativePath.parent_path() == directory;
+
+                            if (!matches)
+                                continue;
+
+                            if (indexedDirectory.kind == FILE_KIND_DESKTOP_FILE && relativePath.extension() != ".desktop")
+                                return false;
+
+                            kind = indexedDirectory.kind;
+                            return true;
+                        }
+
+                        return false;
+                    }
+
+                    std::vector<bf::path> paths(const std::vector<size_t>& positions) {
+                        std::vector<bf::path> result;
+
+                        for (const auto position : positions)
+                            result.push_back(entries[position].path);
+
+                        return result;
+                    }
+            };
+
+            AppDirIndex::AppDirIndex(const bf::path& appDirPath) {
+                d = new PrivateData(appDirPath);
+            }
+
+            AppDirIndex::~AppDirIndex() {
+                delete d;
+            }
+
+            std::vector<bf::path> AppDirIndex::files(FileKind kind) {
+                d->update();
+                return d->paths(d->entriesByKind[kind]);
+            }
+
+            std::vector<bf::path> AppDirIndex::findByFilename(FileKind kind, const std::string& filename, bool matchStem) {
+                d->update();
+
+                std::vector<size_t> positions;
+
+                const auto& byFilename = d->entriesByFilename[kind];
+                const auto filenameIt = byFilename.find(filename);
+
+                if (filenameIt != byFilename.end())
+                    positions = filenameIt->second;
+
+                if (matchStem) {
+                    const auto& byStem = d->entriesByStem[kind];
+                    const auto stemIt = byStem.find(filename);
+
+                    if (stemIt != byStem.end())
+                        positions.insert(positions.end(), stemIt->second.begin(), stemIt->second.end());
+
+                    // files without an extension are found by both their filename and their stem
+                    std::sort(positions.begin(), positions.end());
+                    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+                }
+
+                return d->paths(positions);
+            }
+
+            elf::ElfFileType AppDirIndex::elfFileType(const bf::path& path) {
+                d->update();
+
+                const auto it = d->entriesByPath.find(normalize(path));
+
+                if (it == d->entriesByPath.end())
+                    return elf::ElfFile::probeFileType(path);
+
+                auto& entry = d->entries[it->second];
+
+                if (!entry.elfFileTypeKnown) {
+                    entry.elfFileType = elf::ElfFile::probeFileType(path);
+                    entry.elfFileTypeKnown = true;
+                }
+
+                return entry.elfFileType;
+            }
+
+            void AppDirIndex::addFile(const bf::path& path) {
+                // the index is built on demand, which includes all files created in the meantime
+                if (!d->built)
+                    return;
+
+                FileKind kind;
+
+                if (!d->classify(path, kind))
+                    return;
+
+                struct stat statData{};
+
+                if (stat(path.c_str(), &statData) != 0 || !S_ISREG(statData.st_mode))
+                    return;
+
+                d->addEntry(path, kind);
+
+                // adding the file has modified its directory (and possibly created the directory and its parents),
+                // which must not be mistaken for a modification by others
+                const auto appDirPath = bf::path(normalize(d->appDirPath));
+
+                for (auto directory = bf::path(normalize(path)).parent_path();
+                     !directory.empty() && directory != appDirPath;
+                     directory = directory.parent_path()) {
+                    if (!d->isRecordedDirectory(directory) && !d->isInRecursiveDirectory(directory))
+                        continue;
+
+                    if (stat(directory.c_str(), &statData) == 0)
+                        d->recordDirectory(directory, statData);
+                }
+            }
+
+            void AppDirIndex::invalidate() {
+                d->clear();
+            }
+
+            std::vector<bf::path> listRegularFiles(const bf::path& directory, bool recursive) {
+                std::vector<bf::path> foundPaths;
+
+                walkDirectory(directory, recursive, [&foundPaths](const bf::path& path) {
+                    foundPaths.push_back(path);
+                }, [](const bf::path&, const struct stat&) {});
+
+                return foundPaths;
+            }
+        }
+    }
+}
@@ -0,0 +1,358 @@
+// system headers
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unistd.h>
+#include <vector>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/appdirjournal.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/storage.h"
+
+using namespace linuxdeploy::core::log;
+using namespace linuxdeploy::core::storage;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirjournal {
+            namespace {
+                // must be increased whenever the format of the journal or the meaning of the records changes
+                const std::string JOURNAL_MAGIC = "linuxdeploy-appdir-journal 1";
+
+                // the records consist of tab separated fields, one record per line
+                bool isStorable(const std::string& value) {
+                    return isSingleLine(value) && value.find('\t') == std::string::npos;
+                }
+
+                std::vector<std::string> splitFields(const std::string& line) {
+                    std::vector<std::string> fields;
+                    std::string::size_type start = 0;
+
+                    while (true) {
+                        const auto end = line.find('\t', start);
+
+                        fields.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+
+                        if (end == std::string::npos)
+                            return fields;
+
+                        start = end + 1;
+                    }
+                }
+            }
+
+            class AppDirJournal::PrivateData {
+                public:
+                    // what the interrupted run has recorded about a file
+                    struct Entry {
+                        bool copyPlanned;
+                        std::string sourcePath;
+                        std::string sourceIdentity;
+                        bool copied;
+
+                        bool elfProcessingPlanned;
+                        bool strip;
+                        bool setRPath;
+                        std::string rpath;
+                        bool processed;
+
+                        // identity of the file after the last completed operation
+                        std::string identity;
+
+                        Entry() : copyPlanned(false), sourcePath(), sourceIdentity(), copied(false), elfProcessingPlanned(false),
+                                  strip(false), setRPath(false), rpath(), processed(false), identity() {};
+                    };
+
+                public:
+                    bf::path appDirPath;
+
+                    AppDirKeys keys;
+
+                    std::mutex mutex;
+
+                    // journal of the current run, -1 if not recording
+                    int fd;
+
+                    // the keys are the paths of the files relative to the AppDir
+                    std::map<std::string, Entry> previousRun;
+
+                public:
+                    explicit PrivateData(const bf::path& appDirPath) : appDirPath(appDirPath), keys(appDirPath), mutex(), fd(-1),
+                                                                       previousRun() {};
+
+                    ~PrivateData() {
+                        if (fd >= 0)
+                            close(fd);
+                    }
+
+                public:
+                    // append record to the journal
+                    // records containing values which cannot be stored are dropped, the operations will be repeated
+                    // when resuming then
+                    void write(const std::vector<std::string>& fields) {
+                        std::string record;
+
+                        for (const auto& field : fields) {
+                            if (!isStorable(field))
+                                return;
+
+                            if (!record.empty())
+                                record += '\t';
+
+                            record += field;
+                        }
+
+                        record += '\n';
+
+                        std::lock_guard<std::mutex> lock(mutex);
+
+                        if (fd < 0)
+                            return;
+
+                        // the journal is opened with O_APPEND, and every record is written with a single call, so that
+                        // records written by multiple threads don't interleave
+                        if (::write(fd, record.data(), record.size()) != static_cast<ssize_t>(record.size())) {
+                            ldLog() << LD_WARNING << "Could not write to journal, disabling it" << std::endl;
+                            close(fd);
+                            fd = -1;
+                        }
+                    }
+
+                    // the mutex must be locked by the caller
+                    const Entry* findPreviousEntry(const bf::path& path) const {
+                        const auto it = previousRun.find(keys.getKey(path));
+
+                        if (it == previousRun.end())
+                            return nullptr;
+
+                        return &(it->second);
+                    }
+            };
+
+            AppDirJournal::AppDirJournal(const bf::path& appDirPath) {
+                d = new PrivateData(appDirPath);
+            }
+
+            AppDirJournal::~AppDirJournal() {
+                delete d;
+            }
+
+            bf::path AppDirJournal::getJournalPath(const bf::path& appDirPath) {
+                return appDirPath / ".linuxdeploy-journal";
+            }
+
+            bool AppDirJournal::exists() const {
+                return bf::exists(getJournalPath(d->appDirPath));
+            }
+
+            bool AppDirJournal::loadPreviousRun() {
+                const auto journalPath = getJournalPath(d->appDirPath);
+
+                std::ifstream ifs(journalPath.string());
+
+                if (!ifs)
+                    return false;
+
+                std::string line;
+
+                if (!std::getline(ifs, line) || line != JOURNAL_MAGIC) {
+                    ldLog() << LD_WARNING << "Ignoring journal in unknown format:" << journalPath << std::endl;
+                    return false;
+                }
+
+                std::map<std::string, PrivateData::Entry> entries;
+
+                size_t lineNumber = 1;
+
+                while (std::getline(ifs, line)) {
+                    lineNumber++;
+
+                    // the last record might have been written partially when the run was interrupted
+                    if (ifs.eof())
+                        break;
+
+                    const auto fields = splitFields(line);
+
+                    const auto& type = fields[0];
+
+                    if (fields.size() < 2) {
+                        ldLog() << LD_WARNING << "Ignoring invalid record in journal" << journalPath << "line" << lineNumber << std::endl;
+                        continue;
+                    }
+
+                    auto& entry = entries[fields[1]];
+
+                    if (type == "copy" && fields.size() == 4) {
+                        entry = PrivateData::Entry();
+                        entry.copyPlanned = true;
+                        entry.sourcePath = fields[2];
+                        entry.sourceIdentity = fields[3];
+                    } else if (type == "copied" && fields.size() == 3) {
+                        entry.copied = true;
+                        entry.identity = fields[2];
+                    } else if (type == "elf" && fields.size() == 5) {
+                        entry.elfProcessingPlanned = true;
+                        entry.strip = fields[2] == "1";
+                        entry.setRPath = fields[3] == "1";
+                        entry.rpath = fields[4];
+                        entry.processed = false;
+                    } else if (type == "processed" && fields.size() == 3) {
+                        entry.processed = true;
+                        entry.identity = fields[2];
+                    } else {
+                        ldLog() << LD_WARNING << "Ignoring invalid record in journal" << journalPath << "line" << lineNumber << std::endl;
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+                d->previousRun = entries;
+
+                return true;
+            }
+
+            size_t AppDirJournal::removeTemporaryFiles() {
+                std::map<bf::path, std::set<std::string>> filenamesByDirectory;
+
+                {
+                    std::lock_guard<std::mutex> lock(d->mutex);
+
+                    for (const auto& pair : d->previousRun) {
+                        const auto path = d->appDirPath / pair.first;
+                        filenamesByDirectory[path.parent_path()].insert(path.filename().string());
+                    }
+                }
+
+                size_t removedFiles = 0;
+
+                for (const auto& pair : filenamesByDirectory) {
+                    boost::system::error_code ec;
+
+                    for (bf::directory_iterator i(pair.first, ec); !ec && i != bf::directory_iterator(); i.increment(ec)) {
+                        const auto filename = i->path().filename().string();
+                        const auto suffix = filename.rfind(".linuxdeploy-");
+
+                        if (suffix == std::string::npos || pair.second.count(filename.substr(0, suffix)) == 0)
+                            continue;
+
+                        ldLog() << LD_DEBUG << "Removing temporary file left behind by interrupted run:" << i->path() << std::endl;
+
+                        if (unlink(i->path().c_str()) == 0)
+                            removedFiles++;
+                    }
+                }
+
+                return removedFiles;
+            }
+
+            bool AppDirJournal::begin() {
+                const auto journalPath = getJournalPath(d->appDirPath);
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (d->fd >= 0)
+                    close(d->fd);
+
+                // the journal is created before any files are copied into the AppDir
+                boost::system::error_code ec;
+                bf::create_directories(d->appDirPath, ec);
+
+                d->fd = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+
+                if (d->fd < 0) {
+                    ldLog() << LD_WARNING << "Could not create journal" << journalPath << std::endl;
+                    return false;
+                }
+
+                const auto header = JOURNAL_MAGIC + "\n";
+
+                if (::write(d->fd, header.data(), header.size()) != static_cast<ssize_t>(header.size())) {
+                    ldLog() << LD_WARNING << "Could not write journal" << journalPath << std::endl;
+                    close(d->fd);
+                    d->fd = -1;
+                    return false;
+                }
+
+                return true;
+            }
+
+            void AppDirJournal::sync() {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (d->fd >= 0)
+                    fdatasync(d->fd);
+            }
+
+            void AppDirJournal::finish() {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                if (d->fd < 0)
+                    return;
+
+                close(d->fd);
+                d->fd = -1;
+
+                unlink(getJournalPath(d->appDirPath).c_str());
+            }
+
+            void AppDirJournal::planCopy(const bf::path& path, const bf::path& sourcePath) {
+                d->write({"copy", d->keys.getKey(path), sourcePath.string(), describeFile(sourcePath)});
+            }
+
+            void AppDirJournal::copyCompleted(const bf::path& path) {
+                d->write({"copied", d->keys.getKey(path), describeFile(path)});
+            }
+
+            void AppDirJournal::planElfProcessing(const bf::path& path, bool strip, bool setRPath, const std::string& rpath) {
+                d->write({"elf", d->keys.getKey(path), strip ? "1" : "0", setRPath ? "1" : "0", rpath});
+            }
+
+            void AppDirJournal::elfProcessingCompleted(const bf::path& path) {
+                d->write({"processed", d->keys.getKey(path), describeFile(path)});
+            }
+
+            bool AppDirJournal::wasCopyPlanned(const bf::path& path) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto* entry = d->findPreviousEntry(path);
+
+                return entry != nullptr && entry->copyPlanned;
+            }
+
+            bool AppDirJournal::wasCopyCompleted(const bf::path& path, const bf::path& sourcePath) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto* entry = d->findPreviousEntry(path);
+
+                if (entry == nullptr || !entry->copyPlanned || !entry->copied)
+                    return false;
+
+                if (entry->sourcePath != sourcePath.string() || entry->sourceIdentity != describeFile(sourcePath))
+                    return false;
+
+                return !entry->identity.empty() && entry->identity == describeFile(path);
+            }
+
+            bool AppDirJournal::wasElfProcessingCompleted(const bf::path& path, bool strip, bool setRPath, const std::string& rpath) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto* entry = d->findPreviousEntry(path);
+
+                if (entry == nullptr || !entry->elfProcessingPlanned || !entry->processed)
+                    return false;
+
+                if (entry->strip != strip || entry->setRPath != setRPath || (setRPath && entry->rpath != rpath))
+                    return false;
+
+                return !entry->identity.empty() && entry->identity == describeFile(path);
+            }
+        }
+    }
+}
@@ -0,0 +1,317 @@
+// system headers
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/appdirmanifest.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/storage.h"
+
+using namespace linuxdeploy::core::log;
+using namespace linuxdeploy::core::storage;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace appdirmanifest {
+            namespace {
+                // must be increased whenever the format of the manifest or the meaning of the values changes
+                const std::string MANIFEST_MAGIC = "linuxdeploy-appdir-manifest 2";
+
+                // hash of the contents of a file, formatted as hexadecimal digits
+                // returns an empty string if the file cannot be read
+                std::string describeContents(const bf::path& path) {
+                    uint64_t hash = 0;
+
+                    if (!storage::hashFile(path, hash))
+                        return "";
+
+                    return toHex(hash);
+                }
+
+                // the values are stored one per line, therefore they must not contain line breaks
+                bool isStorable(const std::string& value) {
+                    return isSingleLine(value);
+                }
+
+                // read the rest of the line, without the separating space
+                std::string readRemainder(std::istringstream& iss) {
+                    std::string value;
+                    std::getline(iss, value);
+
+                    if (!value.empty() && value[0] == ' ')
+                        value.erase(0, 1);
+
+                    return value;
+                }
+            }
+
+            class AppDirManifest::PrivateData {
+                public:
+                    struct Entry {
+                        // empty if the file hasn't been copied from another file
+                        std::string sourcePath;
+                        std::string sourceIdentity;
+
+                        bool strip;
+                        bool setRPath;
+                        std::string rpath;
+
+                        std::string outputIdentity;
+                        std::string outputHash;
+
+                        Entry() : sourcePath(), sourceIdentity(), strip(false), setRPath(false), rpath(),
+                                  outputIdentity(), outputHash() {};
+                    };
+
+                public:
+                    bf::path appDirPath;
+
+                    AppDirKeys keys;
+
+                    std::mutex mutex;
+
+                    // the keys are the paths of the files relative to the AppDir
+                    std::map<std::string, Entry> entries;
+
+                public:
+                    explicit PrivateData(const bf::path& appDirPath) : appDirPath(appDirPath), keys(appDirPath), mutex(), entries() {};
+
+                public:
+                    // look up the entry of the file
+                    // the mutex must be locked by the caller
+                    Entry* findEntry(const bf::path& path) {
+                        auto it = entries.find(keys.getKey(path));
+
+                        if (it == entries.end())
+                            return nullptr;
+
+                        return &(it->second);
+                    }
+
+                    // check whether the file is still the one described by the entry
+                    // the mutex must be locked by the caller
+                    static bool isOutputUnchanged(const bf::path& path, Entry& entry) {
+                        const auto identity = describeFile(path);
+
+                        if (identity.empty())
+                            return false;
+
+                        if (identity == entry.outputIdentity)
+                            return true;
+
+                        // the file might have been touched or copied without modifying it
+                        if (describeContents(path) != entry.outputHash)
+                            return false;
+
+                        entry.outputIdentity = identity;
+                        return true;
+                    }
+
+                    void read() {
+                        const auto manifestPath = getManifestPath(appDirPath);
+
+                        std::ifstream ifs(manifestPath.string());
+
+                        if (!ifs)
+                            return;
+
+                        std::string line;
+
+                        if (!std::getline(ifs, line) || line != MANIFEST_MAGIC) {
+                            ldLog() << LD_WARNING << "Ignoring manifest in unknown format:" << manifestPath << std::endl;
+                            return;
+                        }
+
+                        std::map<std::string, Entry> result;
+
+                        auto invalid = [&manifestPath]() {
+                            ldLog() << LD_WARNING << "Ignoring invalid manifest:" << manifestPath << std::endl;
+                        };
+
+                        // every entry consists of a fixed number of lines
+                        while (std::getline(ifs, line)) {
+                            std::string lines[5];
+
+                            for (auto& entryLine : lines) {
+                                if (!std::getline(ifs, entryLine))
+                                    return invalid();
+                            }
+
+                            std::istringstream fileLine(line), sourceLine(lines[0]), sourceIdentityLine(lines[1]),
+                                transformationsLine(lines[2]), outputLine(lines[3]), hashLine(lines[4]);
+
+                            std::string type;
+                            Entry entry;
+
+                            if (!(fileLine >> type) || type != "file")
+                                return invalid();
+
+                            const auto key = readRemainder(fileLine);
+
+                            if (!(sourceLine >> type) || type != "source")
+                                return invalid();
+
+                            entry.sourcePath = readRemainder(sourceLine);
+
+                            if (!(sourceIdentityLine >> type) || type != "source-identity")
+                                return invalid();
+
+                            entry.sourceIdentity = readRemainder(sourceIdentityLine);
+
+                            int strip = 0, setRPath = 0;
+
+                            if (!(transformationsLine >> type >> strip >> setRPath) || type != "transformations")
+                                return invalid();
+
+                            entry.strip = strip != 0;
+                            entry.setRPath = setRPath != 0;
+                            entry.rpath = readRemainder(transformationsLine);
+
+                            if (!(outputLine >> type) || type != "output")
+                                return invalid();
+
+                            entry.outputIdentity = readRemainder(outputLine);
+
+                            if (!(hashLine >> type) || type != "hash")
+                                return invalid();
+
+                            entry.outputHash = readRemainder(hashLine);
+
+                            result[key] = entry;
+                        }
+
+                        entries = result;
+                    }
+            };
+
+            AppDirManifest::AppDirManifest(const bf::path& appDirPath) {
+                d = new PrivateData(appDirPath);
+                d->read();
+            }
+
+            AppDirManifest::~AppDirManifest() {
+                delete d;
+            }
+
+            bf::path AppDirManifest::getManifestPath(const bf::path& appDirPath) {
+                return appDirPath / ".linuxdeploy-manifest";
+            }
+
+            bool AppDirManifest::wasCopiedFrom(const bf::path& path, const bf::path& sourcePath) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto* entry = d->findEntry(path);
+
+                return entry != nullptr && !entry->sourcePath.empty() && entry->sourcePath == sourcePath.string();
+            }
+
+            bool AppDirManifest::isUpToDate(const bf::path& path, const bf::path& sourcePath,
+                                            bool strip, bool setRPath, const std::string& rpath) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto* entry = d->findEntry(path);
+
+                if (entry == nullptr || entry->sourcePath.empty() || entry->sourcePath != sourcePath.string())
+                    return false;
+
+                if (entry->sourceIdentity != describeFile(sourcePath))
+                    return false;
+
+                if (entry->strip != strip || entry->setRPath != setRPath || (setRPath && entry->rpath != rpath))
+                    return false;
+
+                return d->isOutputUnchanged(path, *entry);
+            }
+
+            bool AppDirManifest::areTransformationsApplied(const bf::path& path, bool strip, bool setRPath,
+                                                           const std::string& rpath) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto* entry = d->findEntry(path);
+
+                if (entry == nullptr)
+                    return false;
+
+                if ((strip && !entry->strip) || (setRPath && (!entry->setRPath || entry->rpath != rpath)))
+                    return false;
+
+                return d->isOutputUnchanged(path, *entry);
+            }
+
+            void AppDirManifest::update(const bf::path& path, const bf::path& sourcePath,
+                                        bool strip, bool setRPath, const std::string& rpath) {
+                if (!isStorable(path.string()) || !isStorable(sourcePath.string()) || !isStorable(rpath)) {
+                    remove(path);
+                    return;
+                }
+
+                // the files are read without holding the lock
+                const auto sourceIdentity = sourcePath.empty() ? "" : describeFile(sourcePath);
+                const auto outputIdentity = describeFile(path);
+                const auto outputHash = describeContents(path);
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto& entry = d->entries[d->keys.getKey(path)];
+
+                if (!sourcePath.empty()) {
+                    entry = PrivateData::Entry();
+                    entry.sourcePath = sourcePath.string();
+                    entry.sourceIdentity = sourceIdentity;
+                }
+
+                entry.strip = entry.strip || strip;
+
+                if (setRPath) {
+                    entry.setRPath = true;
+                    entry.rpath = rpath;
+                }
+
+                entry.outputIdentity = outputIdentity;
+                entry.outputHash = outputHash;
+            }
+
+            void AppDirManifest::remove(const bf::path& path) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                d->entries.erase(d->keys.getKey(path));
+            }
+
+            bool AppDirManifest::save() {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto manifestPath = getManifestPath(d->appDirPath);
+
+                std::ostringstream oss;
+                oss << MANIFEST_MAGIC << "\n";
+
+                for (const auto& pair : d->entries) {
+                    const auto& entry = pair.second;
+
+                    oss << "file " << pair.first << "\n"
+                        << "source " << entry.sourcePath << "\n"
+                        << "source-identity " << entry.sourceIdentity << "\n"
+                        << "transformations " << entry.strip << " " << entry.setRPath << " " << entry.rpath << "\n"
+                        << "output " << entry.outputIdentity << "\n"
+                        << "hash " << entry.outputHash << "\n";
+                }
+
+                // the manifest is replaced atomically, so that an interrupted run doesn't leave a broken one behind
+                if (!writeFileAtomically(manifestPath, oss.str())) {
+                    ldLog() << LD_WARNING << "Could not write manifest" << manifestPath << std::endl;
+                    return false;
+                }
+
+                ldLog() << LD_DEBUG << "Wrote" << d->entries.size() << "entries to manifest" << manifestPath << std::endl;
+
+                return true;
+            }
+        }
+    }
+}
@@ -1,12 +1,26 @@
 // system includes
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <elf.h>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // library includes
-#include <boost/regex.hpp>
 #include <subprocess.hpp>
 
 // local headers
 #include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/libraryresolver.h"
 #include "linuxdeploy/core/log.h"
 #include "linuxdeploy/util/util.h"
 
@@ -17,14 +31,1436 @@ namespace bf = boost::filesystem;
 namespace linuxdeploy {
     namespace core {
         namespace elf {
+            namespace {
+                // program header, converted to host byte order
+                struct Segment {
+                    uint32_t type;
+                    uint64_t offset;
+                    uint64_t virtualAddress;
+                    uint64_t fileSize;
+                };
+
+                // section header, converted to host byte order
+                struct Section {
+                    std::string name;
+                    uint32_t nameIndex;
+                    uint32_t type;
+                    uint64_t flags;
+                    uint64_t address;
+                    uint64_t offset;
+                    uint64_t size;
+                    uint32_t link;
+                    uint32_t info;
+                    uint64_t addressAlignment;
+                    uint64_t entrySize;
+                };
+
+                // dynamic section entry, converted to host byte order
+                struct DynamicEntry {
+                    int64_t tag;
+                    uint64_t value;
+
+                    // location of the entry in the file
+                    uint64_t fileOffset;
+                };
+
+                // bytes to be overwritten when writing a file, used to edit values without changing the layout
+                struct FilePatch {
+                    uint64_t offset;
+                    std::vector<char> data;
+                };
+
+                // identifies the contents of a file on disk
+                // if a file is replaced or modified, its identity changes
+                struct FileIdentity {
+                    dev_t device;
+                    ino_t inode;
+                    off_t size;
+                    time_t modificationTime;
+                    long modificationTimeNanoseconds;
+
+                    static FileIdentity fromStat(const struct stat& statData) {
+                        return {statData.st_dev, statData.st_ino, statData.st_size, statData.st_mtim.tv_sec, statData.st_mtim.tv_nsec};
+                    }
+
+                    bool operator==(const FileIdentity& other) const {
+                        return device == other.device && inode == other.inode && size == other.size &&
+                               modificationTime == other.modificationTime &&
+                               modificationTimeNanoseconds == other.modificationTimeNanoseconds;
+                    }
+                };
+
+                // reverse byte order of integer values of any size
+                template<typename T>
+                T swapBytes(T value) {
+                    T result;
+                    auto* in = reinterpret_cast<unsigned char*>(&value);
+                    auto* out = reinterpret_cast<unsigned char*>(&result);
+
+                    for (size_t i = 0; i < sizeof(T); i++)
+                        out[i] = in[sizeof(T) - 1 - i];
+
+                    return result;
+                }
+
+                // reads just the headers of a file using pread(), without mapping the file or throwing exceptions
+                // performs the same checks as ElfFile's constructor, so files are considered ELF files by both or neither
+                class HeaderProbe {
+                    private:
+                        int fd;
+                        uint64_t size;
+                        bool swap;
+
+                    public:
+                        HeaderProbe(int fd, uint64_t size, bool swap) : fd(fd), size(size), swap(swap) {}
+
+                        template<typename T>
+                        T convert(T value) const {
+                            return swap ? swapBytes(value) : value;
+                        }
+
+                        bool read(uint64_t offset, void* buffer, size_t length) const {
+                            if (offset > size || length > size - offset)
+                                return false;
+
+                            return pread(fd, buffer, length, static_cast<off_t>(offset)) == static_cast<ssize_t>(length);
+                        }
+
+                        template<typename Ehdr, typename Phdr, typename Dyn>
+                        ElfFileType probe() const {
+                            Ehdr header{};
+
+                            if (!read(0, &header, sizeof(header)))
+                                return ELF_FILE_TYPE_NONE;
+
+                            const uint16_t type = convert(header.e_type);
+                            const uint64_t programHeadersOffset = convert(header.e_phoff);
+                            const uint16_t programHeaderSize = convert(header.e_phentsize);
+                            const uint16_t programHeaderCount = convert(header.e_phnum);
+
+                            bool hasInterpreter = false;
+                            uint64_t dynamicOffset = 0;
+                            uint64_t dynamicSize = 0;
+
+                            if (programHeaderCount > 0) {
+                                if (programHeaderSize < sizeof(Phdr))
+                                    return ELF_FILE_TYPE_NONE;
+
+                                // all program headers are read at once
+                                std::vector<char> programHeaders(static_cast<size_t>(programHeaderSize) * programHeaderCount);
+
+                                if (!read(programHeadersOffset, programHeaders.data(), programHeaders.size()))
+                                    return ELF_FILE_TYPE_NONE;
+
+                                for (uint16_t i = 0; i < programHeaderCount; i++) {
+                                    Phdr programHeader{};
+                                    memcpy(&programHeader, programHeaders.data() + static_cast<size_t>(i) * programHeaderSize, sizeof(Phdr));
+
+                                    const auto segmentType = convert(programHeader.p_type);
+
+                                    if (segmentType == PT_INTERP) {
+                                        hasInterpreter = true;
+                                    } else if (segmentType == PT_DYNAMIC) {
+                                        dynamicOffset = convert(programHeader.p_offset);
+                                        dynamicSize = convert(programHeader.p_filesz);
+                                    }
+                                }
+                            }
+
+                            if (type == ET_EXEC)
+                                return ELF_FILE_TYPE_EXECUTABLE;
+
+                            if (type != ET_DYN)
+                                return ELF_FILE_TYPE_OTHER;
+
+                            if (!hasInterpreter)
+                                return ELF_FILE_TYPE_SHARED_OBJECT;
+
+                            // some libraries (e.g., libc) have an interpreter, too, as they can be run, therefore
+                            // position independent executables are identified by the DF_1_PIE flag
+                            // older toolchains don't set the flag, in that case, files without a DT_SONAME entry are
+                            // assumed to be executables
+                            std::vector<Dyn> dynamicEntries(static_cast<size_t>(std::min<uint64_t>(dynamicSize, 64 * 1024) / sizeof(Dyn)));
+
+                            if (dynamicEntries.empty() || !read(dynamicOffset, dynamicEntries.data(), dynamicEntries.size() * sizeof(Dyn)))
+                                return ELF_FILE_TYPE_PIE;
+
+                            bool hasSoname = false;
+
+                            for (const auto& entry : dynamicEntries) {
+                                const int64_t tag = convert(entry.d_tag);
+
+                                if (tag == DT_NULL)
+                                    break;
+
+                                if (tag == DT_FLAGS_1 && (convert(entry.d_un.d_val) & DF_1_PIE) != 0)
+                                    return ELF_FILE_TYPE_PIE;
+
+                                if (tag == DT_SONAME)
+                                    hasSoname = true;
+                            }
+
+                            return hasSoname ? ELF_FILE_TYPE_SHARED_OBJECT : ELF_FILE_TYPE_PIE;
+                        }
+                };
+            }
+
             class ElfFile::PrivateData {
                 public:
                     const bf::path path;
 
-                public:
-                    explicit PrivateData(const bf::path& path) : path(path) {}
+                    // read-only mapping of the entire file
+                    // all the data is read from this mapping, the file is never executed or loaded
+                    const unsigned char* data;
+                    size_t size;
+
+                    // information from the ELF header
+                    uint8_t elfClass;
+                    uint8_t elfDataEncoding;
+                    uint16_t elfType;
+                    uint16_t elfMachine;
+
+                    std::vector<Segment> segments;
+
+                    // the section headers are parsed on demand
+                    bool sectionHeadersParsed;
+                    std::vector<Section> sections;
+
+                    // the dynamic section is parsed on demand
+                    bool dynamicSectionParsed;
+                    std::vector<DynamicEntry> dynamicEntries;
+                    uint64_t dynamicStringTableOffset;
+                    uint64_t dynamicStringTableSize;
+
+                    // the data is shared by all ElfFile objects referring to the same file, and may be used by several
+                    // threads at the same time
+                    // must be locked while accessing any of the members above
+                    std::recursive_mutex mutex;
+
+                    // identity of the mapped file, protected by the registry mutex
+                    FileIdentity identity;
+
+                public:
+                    explicit PrivateData(const bf::path& path) : path(path), data(nullptr), size(0), elfClass(ELFCLASSNONE),
+                                                                 elfDataEncoding(ELFDATANONE), elfType(ET_NONE),
+                                                                 elfMachine(EM_NONE), segments(), sectionHeadersParsed(false),
+                                                                 sections(), dynamicSectionParsed(false),
+                                                                 dynamicEntries(), dynamicStringTableOffset(0),
+                                                                 dynamicStringTableSize(0), mutex(), identity() {
+                        load();
+                    }
+
+                private:
+                    // all the files opened during a run are kept in a registry, so they are mapped and parsed once only
+                    // the key is the absolute path of the file
+                    static std::mutex registryMutex;
+                    static std::map<std::string, std::shared_ptr<PrivateData>> registry;
+
+                public:
+                    // look up file in the registry, or map it if it hasn't been opened yet, or has changed since
+                    static std::shared_ptr<PrivateData> getShared(const bf::path& path) {
+                        struct stat statData{};
+
+                        if (stat(path.c_str(), &statData) != 0)
+                            throw ElfFileParseError("No such file or directory: " + path.string());
+
+                        const auto key = bf::absolute(path).string();
+                        const auto currentIdentity = FileIdentity::fromStat(statData);
+
+                        {
+                            std::lock_guard<std::mutex> lock(registryMutex);
+
+                            auto it = registry.find(key);
+
+                            if (it != registry.end() && it->second->identity == currentIdentity)
+                                return it->second;
+                        }
+
+                        // mapping and parsing the file doesn't require the lock
+                        std::shared_ptr<PrivateData> file(new PrivateData(path));
+
+                        std::lock_guard<std::mutex> lock(registryMutex);
+                        registry[key] = file;
+
+                        return file;
+                    }
+
+                    static void clearRegistry() {
+                        std::lock_guard<std::mutex> lock(registryMutex);
+                        registry.clear();
+                    }
+
+                    ~PrivateData() {
+                        unmapFile();
+                    }
+
+                public:
+                    // (re-)map the file and parse its headers
+                    // must be called after the file has been modified by external tools, the mapping might be invalid
+                    // otherwise
+                    void load() {
+                        unmapFile();
+
+                        segments.clear();
+                        sections.clear();
+                        sectionHeadersParsed = false;
+                        dynamicEntries.clear();
+                        dynamicSectionParsed = false;
+                        dynamicStringTableOffset = 0;
+                        dynamicStringTableSize = 0;
+
+                        mapFile();
+
+                        try {
+                            parseHeaders();
+                        } catch (...) {
+                            unmapFile();
+                            throw;
+                        }
+                    }
+
+                private:
+                    void mapFile() {
+                        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                        if (fd < 0)
+                            throw ElfFileParseError("Could not open file: " + path.string());
+
+                        struct stat statData{};
+
+                        if (fstat(fd, &statData) != 0 || !S_ISREG(statData.st_mode)) {
+                            close(fd);
+                            throw ElfFileParseError("Not a regular file: " + path.string());
+                        }
+
+                        if (statData.st_size < EI_NIDENT) {
+                            close(fd);
+                            throw ElfFileParseError("Invalid magic bytes in file header");
+                        }
+
+                        auto* mapping = mmap(nullptr, static_cast<size_t>(statData.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+                        // the mapping stays valid after closing the file descriptor
+                        close(fd);
+
+                        if (mapping == MAP_FAILED)
+                            throw ElfFileParseError("Could not map file: " + path.string());
+
+                        data = static_cast<const unsigned char*>(mapping);
+                        size = static_cast<size_t>(statData.st_size);
+
+                        std::lock_guard<std::mutex> lock(registryMutex);
+                        identity = FileIdentity::fromStat(statData);
+                    }
+
+                    void unmapFile() {
+                        if (data != nullptr) {
+                            munmap(const_cast<unsigned char*>(data), size);
+                            data = nullptr;
+                            size = 0;
+                        }
+                    }
+
+                public:
+                    // convert value read from the file to host byte order
+                    template<typename T>
+                    T convert(T value) const {
+                        #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                        static const uint8_t hostDataEncoding = ELFDATA2LSB;
+                        #else
+                        static const uint8_t hostDataEncoding = ELFDATA2MSB;
+                        #endif
+
+                        if (elfDataEncoding == hostDataEncoding)
+                            return value;
+
+                        return swapBytes(value);
+                    }
+
+                    // make sure a range lies within the file
+                    // the file may have been crafted, therefore all offsets and sizes must be checked before use
+                    bool isInFile(uint64_t offset, uint64_t length) const {
+                        return offset <= size && length <= size - offset;
+                    }
+
+                    template<typename T>
+                    void readStruct(uint64_t offset, T& out) const {
+                        if (!isInFile(offset, sizeof(T)))
+                            throw ElfFileParseError("Truncated or corrupt ELF file: " + path.string());
+
+                        memcpy(&out, data + offset, sizeof(T));
+                    }
+
+                    // read single integer value and convert it to host byte order
+                    template<typename T>
+                    T readValue(uint64_t offset) const {
+                        T value;
+                        readStruct(offset, value);
+                        return convert(value);
+                    }
+
+                    // translate virtual address to file offset using the loadable segments
+                    // returns false if the address is not backed by the file
+                    bool virtualAddressToOffset(uint64_t address, uint64_t& offset) const {
+                        for (const auto& segment : segments) {
+                            if (segment.type != PT_LOAD)
+                                continue;
+
+                            if (address >= segment.virtualAddress && address - segment.virtualAddress < segment.fileSize) {
+                                offset = segment.offset + (address - segment.virtualAddress);
+                                return true;
+                            }
+                        }
+
+                        return false;
+                    }
+
+                private:
+                    template<typename Ehdr, typename Phdr>
+                    void parseHeaders() {
+                        Ehdr header{};
+                        readStruct(0, header);
+
+                        elfType = convert(header.e_type);
+                        elfMachine = convert(header.e_machine);
+
+                        const uint64_t programHeadersOffset = convert(header.e_phoff);
+                        const uint16_t programHeaderSize = convert(header.e_phentsize);
+                        const uint16_t programHeaderCount = convert(header.e_phnum);
+
+                        if (programHeaderCount == 0)
+                            return;
+
+                        if (programHeaderSize < sizeof(Phdr))
+                            throw ElfFileParseError("Invalid program header size in file: " + path.string());
+
+                        if (!isInFile(programHeadersOffset, static_cast<uint64_t>(programHeaderSize) * programHeaderCount))
+                            throw ElfFileParseError("Program headers out of bounds in file: " + path.string());
+
+                        for (uint16_t i = 0; i < programHeaderCount; i++) {
+                            Phdr programHeader{};
+                            readStruct(programHeadersOffset + static_cast<uint64_t>(i) * programHeaderSize, programHeader);
+
+                            Segment segment{};
+                            segment.type = convert(programHeader.p_type);
+                            segment.offset = convert(programHeader.p_offset);
+                            segment.virtualAddress = convert(programHeader.p_vaddr);
+                            segment.fileSize = convert(programHeader.p_filesz);
+                            segments.push_back(segment);
+                        }
+                    }
+
+                    void parseHeaders() {
+                        if (strncmp(reinterpret_cast<const char*>(data), ELFMAG, SELFMAG) != 0)
+                            throw ElfFileParseError("Invalid magic bytes in file header");
+
+                        elfClass = data[EI_CLASS];
+                        elfDataEncoding = data[EI_DATA];
+
+                        if (elfDataEncoding != ELFDATA2LSB && elfDataEncoding != ELFDATA2MSB)
+                            throw ElfFileParseError("Invalid data encoding in file header: " + path.string());
+
+                        switch (elfClass) {
+                            case ELFCLASS32:
+                                parseHeaders<Elf32_Ehdr, Elf32_Phdr>();
+                                break;
+                            case ELFCLASS64:
+                                parseHeaders<Elf64_Ehdr, Elf64_Phdr>();
+                                break;
+                            default:
+                                throw ElfFileParseError("Invalid ELF class in file header: " + path.string());
+                        }
+                    }
+
+                    template<typename Ehdr, typename Shdr>
+                    void parseSectionHeaders() {
+                        Ehdr header{};
+                        readStruct(0, header);
+
+                        const uint64_t sectionHeadersOffset = convert(header.e_shoff);
+                        const uint16_t sectionHeaderSize = convert(header.e_shentsize);
+                        uint64_t sectionHeaderCount = convert(header.e_shnum);
+                        uint32_t sectionNamesIndex = convert(header.e_shstrndx);
+
+                        if (sectionHeadersOffset == 0)
+                            return;
+
+                        if (sectionHeaderSize < sizeof(Shdr))
+                            throw ElfFileParseError("Invalid section header size in file: " + path.string());
+
+                        // if there are too many sections, the real values are stored in the first section header
+                        Shdr firstSectionHeader{};
+                        readStruct(sectionHeadersOffset, firstSectionHeader);
+
+                        if (sectionHeaderCount == 0)
+                            sectionHeaderCount = convert(firstSectionHeader.sh_size);
+
+                        if (sectionNamesIndex == SHN_XINDEX)
+                            sectionNamesIndex = convert(firstSectionHeader.sh_link);
+
+                        if (!isInFile(sectionHeadersOffset, sectionHeaderSize * sectionHeaderCount))
+                            throw ElfFileParseError("Section headers out of bounds in file: " + path.string());
+
+                        for (uint64_t i = 0; i < sectionHeaderCount; i++) {
+                            Shdr sectionHeader{};
+                            readStruct(sectionHeadersOffset + i * sectionHeaderSize, sectionHeader);
+
+                            Section section{};
+                            section.nameIndex = convert(sectionHeader.sh_name);
+                            section.type = convert(sectionHeader.sh_type);
+                            section.flags = convert(sectionHeader.sh_flags);
+                            section.address = convert(sectionHeader.sh_addr);
+                            section.offset = convert(sectionHeader.sh_offset);
+                            section.size = convert(sectionHeader.sh_size);
+                            section.link = convert(sectionHeader.sh_link);
+                            section.info = convert(sectionHeader.sh_info);
+                            section.addressAlignment = convert(sectionHeader.sh_addralign);
+                            section.entrySize = convert(sectionHeader.sh_entsize);
+
+                            sections.push_back(section);
+                        }
+
+                        // the names are optional
+                        if (sectionNamesIndex >= sections.size() || sections[sectionNamesIndex].type != SHT_STRTAB)
+                            return;
+
+                        const auto& namesSection = sections[sectionNamesIndex];
+
+                        if (!isInFile(namesSection.offset, namesSection.size))
+                            throw ElfFileParseError("Section names out of bounds in file: " + path.string());
+
+                        for (auto& section : sections)
+                            section.name = readString(namesSection.offset, namesSection.size, section.nameIndex);
+                    }
+
+                    template<typename Dyn>
+                    void parseDynamicSection() {
+                        // like patchelf, the section headers are used to locate the dynamic section and its string
+                        // table
+                        // they are optional at runtime, though, therefore the program headers are used as a fallback
+                        uint64_t dynamicOffset = 0;
+                        uint64_t dynamicSize = 0;
+                        bool dynamicFound = false;
+
+                        const Section* stringTableSection = nullptr;
+
+                        try {
+                            parseSectionHeaders();
+                        } catch (const ElfFileParseError& e) {
+                            ldLog() << LD_DEBUG << "Ignoring invalid section headers:" << e.what() << std::endl;
+                            sections.clear();
+                        }
+
+                        for (const auto& section : sections) {
+                            if (section.type != SHT_DYNAMIC)
+                                continue;
+
+                            dynamicOffset = section.offset;
+                            dynamicSize = section.size;
+                            dynamicFound = true;
+
+                            if (section.link < sections.size() && sections[section.link].type == SHT_STRTAB)
+                                stringTableSection = &sections[section.link];
+
+                            break;
+                        }
+
+                        if (!dynamicFound) {
+                            for (const auto& segment : segments) {
+                                if (segment.type != PT_DYNAMIC)
+                                    continue;
+
+                                dynamicOffset = segment.offset;
+                                dynamicSize = segment.fileSize;
+                                dynamicFound = true;
+
+                                // there may only be one dynamic segment
+                                break;
+                            }
+                        }
+
+                        // statically linked file
+                        if (!dynamicFound)
+                            return;
+
+                        if (!isInFile(dynamicOffset, dynamicSize))
+                            throw ElfFileParseError("Dynamic section out of bounds in file: " + path.string());
+
+                        for (uint64_t i = 0; i < dynamicSize / sizeof(Dyn); i++) {
+                            Dyn dyn{};
+                            readStruct(dynamicOffset + i * sizeof(Dyn), dyn);
+
+                            DynamicEntry entry{};
+                            entry.tag = convert(dyn.d_tag);
+                            entry.value = convert(dyn.d_un.d_val);
+                            entry.fileOffset = dynamicOffset + i * sizeof(Dyn);
+
+                            if (entry.tag == DT_NULL)
+                                break;
+
+                            dynamicEntries.push_back(entry);
+                        }
+
+                        if (stringTableSection != nullptr) {
+                            dynamicStringTableOffset = stringTableSection->offset;
+                            dynamicStringTableSize = stringTableSection->size;
+                        } else {
+                            uint64_t stringTableAddress = 0;
+                            bool stringTableFound = false;
+
+                            for (const auto& entry : dynamicEntries) {
+                                if (entry.tag == DT_STRTAB) {
+                                    stringTableAddress = entry.value;
+                                    stringTableFound = true;
+                                } else if (entry.tag == DT_STRSZ) {
+                                    dynamicStringTableSize = entry.value;
+                                }
+                            }
+
+                            if (!stringTableFound)
+                                return;
+
+                            if (!virtualAddressToOffset(stringTableAddress, dynamicStringTableOffset)) {
+                                throw ElfFileParseError("Dynamic string table out of bounds in file: " + path.string());
+                            }
+                        }
+
+                        if (!isInFile(dynamicStringTableOffset, dynamicStringTableSize))
+                            throw ElfFileParseError("Dynamic string table out of bounds in file: " + path.string());
+                    }
+
+                public:
+                    void parseSectionHeaders() {
+                        if (sectionHeadersParsed)
+                            return;
+
+                        // make sure the headers are parsed once only, even if they turn out to be invalid
+                        sectionHeadersParsed = true;
+
+                        if (elfClass == ELFCLASS32) {
+                            parseSectionHeaders<Elf32_Ehdr, Elf32_Shdr>();
+                        } else {
+                            parseSectionHeaders<Elf64_Ehdr, Elf64_Shdr>();
+                        }
+                    }
+
+                    void parseDynamicSection() {
+                        if (dynamicSectionParsed)
+                            return;
+
+                        if (elfClass == ELFCLASS32) {
+                            parseDynamicSection<Elf32_Dyn>();
+                        } else {
+                            parseDynamicSection<Elf64_Dyn>();
+                        }
+
+                        dynamicSectionParsed = true;
+                    }
+
+                    // read string from a string table at the given location
+                    // the caller must make sure the table lies within the file
+                    std::string readString(uint64_t tableOffset, uint64_t tableSize, uint64_t index) const {
+                        if (index >= tableSize)
+                            throw ElfFileParseError("Invalid string table index in file: " + path.string());
+
+                        const auto* begin = reinterpret_cast<const char*>(data + tableOffset + index);
+                        const auto maxLength = static_cast<size_t>(tableSize - index);
+
+                        // strings must be terminated within the table
+                        const auto* end = static_cast<const char*>(memchr(begin, '\0', maxLength));
+
+                        if (end == nullptr)
+                            throw ElfFileParseError("Unterminated string in string table in file: " + path.string());
+
+                        return std::string(begin, end);
+                    }
+
+                    // read string from dynamic string table
+                    std::string readDynamicString(uint64_t index) const {
+                        return readString(dynamicStringTableOffset, dynamicStringTableSize, index);
+                    }
+
+                    // return values of all entries in the dynamic section with a given tag which refer to strings
+                    std::vector<std::string> getDynamicStrings(int64_t tag) {
+                        parseDynamicSection();
+
+                        std::vector<std::string> values;
+
+                        for (const auto& entry : dynamicEntries) {
+                            if (entry.tag == tag)
+                                values.push_back(readDynamicString(entry.value));
+                        }
+
+                        return values;
+                    }
+
+                    bool hasDynamicEntry(int64_t tag) {
+                        parseDynamicSection();
+
+                        for (const auto& entry : dynamicEntries) {
+                            if (entry.tag == tag)
+                                return true;
+                        }
+
+                        return false;
+                    }
+
+                    std::string getDynamicString(int64_t tag) {
+                        auto values = getDynamicStrings(tag);
+
+                        if (values.empty())
+                            return "";
+
+                        return values.front();
+                    }
+
+                    // returns the path of the program interpreter (dynamic linker) requested by the file, if any
+                    std::string getInterpreter() const {
+                        for (const auto& segment : segments) {
+                            if (segment.type != PT_INTERP)
+                                continue;
+
+                            if (!isInFile(segment.offset, segment.fileSize) || segment.fileSize == 0)
+                                throw ElfFileParseError("Interpreter out of bounds in file: " + path.string());
+
+                            const auto* begin = reinterpret_cast<const char*>(data + segment.offset);
+                            const auto* end = static_cast<const char*>(memchr(begin, '\0', static_cast<size_t>(segment.fileSize)));
+
+                            if (end == nullptr)
+                                throw ElfFileParseError("Unterminated interpreter path in file: " + path.string());
+
+                            return std::string(begin, end);
+                        }
+
+                        return "";
+                    }
+
+                    // collect the indices of all the strings in the dynamic string table the file refers to
+                    // the dynamic entries, the dynamic symbols and the version information share the table, and linkers
+                    // merge strings which are suffixes of other strings
+                    // returns false if not all of the references can be determined
+                    bool collectDynamicStringReferences(std::vector<uint64_t>& references) {
+                        parseDynamicSection();
+
+                        for (const auto& entry : dynamicEntries) {
+                            switch (entry.tag) {
+                                case DT_NEEDED:
+                                case DT_SONAME:
+                                case DT_RPATH:
+                                case DT_RUNPATH:
+                                case DT_AUXILIARY:
+                                case DT_FILTER:
+                                case DT_CONFIG:
+                                case DT_DEPAUDIT:
+                                case DT_AUDIT:
+                                    references.push_back(entry.value);
+                                    break;
+                                default:
+                                    break;
+                            }
+                        }
+
+                        // the symbols can only be enumerated reliably using the section headers
+                        bool dynamicSymbolsFound = false;
+
+                        for (const auto& section : sections) {
+                            if (!isInFile(section.offset, section.size))
+                                return false;
+
+                            if (section.type == SHT_DYNSYM) {
+                                const uint64_t symbolSize = elfClass == ELFCLASS32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym);
+
+                                // st_name is the first member in both variants
+                                for (uint64_t offset = section.offset; offset + symbolSize <= section.offset + section.size; offset += symbolSize)
+                                    references.push_back(readValue<uint32_t>(offset));
+
+                                dynamicSymbolsFound = true;
+                            } else if (section.type == SHT_GNU_verneed || section.type == SHT_GNU_verdef) {
+                                // the version structures have the same layout in 32-bit and 64-bit files
+                                // the number of iterations is limited to protect against loops in crafted files
+                                uint64_t offset = section.offset;
+                                const uint64_t end = section.offset + section.size;
+
+                                for (uint64_t i = 0; i < section.size && offset < end; i++) {
+                                    uint64_t auxiliaryOffset;
+                                    uint16_t auxiliaryCount;
+
+                                    if (section.type == SHT_GNU_verneed) {
+                                        Elf32_Verneed verneed{};
+                                        readStruct(offset, verneed);
+                                        references.push_back(convert(verneed.vn_file));
+                                        auxiliaryCount = convert(verneed.vn_cnt);
+                                        auxiliaryOffset = offset + convert(verneed.vn_aux);
+                                    } else {
+                                        Elf32_Verdef verdef{};
+                                        readStruct(offset, verdef);
+                                        auxiliaryCount = convert(verdef.vd_cnt);
+                                        auxiliaryOffset = offset + convert(verdef.vd_aux);
+                                    }
+
+                                    for (uint16_t j = 0; j < auxiliaryCount; j++) {
+                                        uint32_t next;
+
+                                        if (section.type == SHT_GNU_verneed) {
+                                            Elf32_Vernaux vernaux{};
+                                            readStruct(auxiliaryOffset, vernaux);
+                                            references.push_back(convert(vernaux.vna_name));
+                                            next = convert(vernaux.vna_next);
+                                        } else {
+                                            Elf32_Verdaux verdaux{};
+                                            readStruct(auxiliaryOffset, verdaux);
+                                            references.push_back(convert(verdaux.vda_name));
+                                            next = convert(verdaux.vda_next);
+                                        }
+
+                                        if (next == 0)
+                                            break;
+
+                                        auxiliaryOffset += next;
+                                    }
+
+                                    const auto next = section.type == SHT_GNU_verneed
+                                                      ? readValue<uint32_t>(offset + offsetof(Elf32_Verneed, vn_next))
+                                                      : readValue<uint32_t>(offset + offsetof(Elf32_Verdef, vd_next));
+
+                                    if (next == 0)
+                                        break;
+
+                                    offset += next;
+                                }
+                            }
+                        }
+
+                        // without section headers, there's no way to tell how many dynamic symbols there are
+                        if (!dynamicSymbolsFound && hasDynamicEntry(DT_SYMTAB))
+                            return false;
+
+                        return true;
+                    }
+
+                    // determine the bytes which have to be overwritten to replace the rpath without changing the
+                    // layout of the file
+                    // this is possible if the new value fits into the space of the existing string, and the string is
+                    // not shared with any other reference into the string table
+                    // returns false if the rpath can't be replaced in place
+                    bool planRPathPatches(const std::string& value, std::vector<FilePatch>& patches) {
+                        parseDynamicSection();
+
+                        const DynamicEntry* rpathEntry = nullptr;
+                        const DynamicEntry* runpathEntry = nullptr;
+
+                        for (const auto& entry : dynamicEntries) {
+                            if (entry.tag == DT_RPATH && rpathEntry == nullptr)
+                                rpathEntry = &entry;
+                            else if (entry.tag == DT_RUNPATH && runpathEntry == nullptr)
+                                runpathEntry = &entry;
+                        }
+
+                        // like patchelf, prefer DT_RUNPATH, and convert DT_RPATH to DT_RUNPATH otherwise
+                        const auto* entry = runpathEntry != nullptr ? runpathEntry : rpathEntry;
+
+                        // a new entry would have to be added
+                        if (entry == nullptr)
+                            return false;
+
+                        const auto oldValue = readDynamicString(entry->value);
+
+                        if (value.size() > oldValue.size())
+                            return false;
+
+                        std::vector<uint64_t> references;
+                        if (!collectDynamicStringReferences(references))
+                            return false;
+
+                        // the string must not be shared with any other reference, except for the other rpath entries
+                        // which will be ignored by the dynamic linker anyway
+                        size_t referencesToString = 0;
+
+                        for (const auto reference : references) {
+                            if (reference > entry->value && reference < entry->value + oldValue.size())
+                                return false;
+
+                            if (reference == entry->value)
+                                referencesToString++;
+                        }
+
+                        size_t rpathEntriesReferencingString = 0;
+
+                        for (const auto& other : dynamicEntries) {
+                            if ((other.tag == DT_RPATH || other.tag == DT_RUNPATH) && other.value == entry->value)
+                                rpathEntriesReferencingString++;
+                        }
+
+                        if (referencesToString > rpathEntriesReferencingString)
+                            return false;
+
+                        // pad the new value with null bytes
+                        FilePatch stringPatch{dynamicStringTableOffset + entry->value, std::vector<char>(oldValue.size() + 1, '\0')};
+                        std::copy(value.begin(), value.end(), stringPatch.data.begin());
+                        patches.push_back(stringPatch);
+
+                        if (entry->tag == DT_RPATH) {
+                            FilePatch tagPatch{entry->fileOffset, {}};
+
+                            if (elfClass == ELFCLASS32) {
+                                auto tag = convert(static_cast<Elf32_Sword>(DT_RUNPATH));
+                                tagPatch.data.assign(reinterpret_cast<char*>(&tag), reinterpret_cast<char*>(&tag) + sizeof(tag));
+                            } else {
+                                auto tag = convert(static_cast<Elf64_Sxword>(DT_RUNPATH));
+                                tagPatch.data.assign(reinterpret_cast<char*>(&tag), reinterpret_cast<char*>(&tag) + sizeof(tag));
+                            }
+
+                            patches.push_back(tagPatch);
+                        }
+
+                        return true;
+                    }
+
+                    // write patches to a file descriptor
+                    static bool applyPatches(int fd, const std::vector<FilePatch>& patches) {
+                        for (const auto& patch : patches) {
+                            if (pwrite(fd, patch.data.data(), patch.data.size(), static_cast<off_t>(patch.offset)) != static_cast<ssize_t>(patch.data.size()))
+                                return false;
+                        }
+
+                        return true;
+                    }
+
+                    // files with multiple hardlinks (e.g., files hardlinked into the AppDir by a previous run) are
+                    // replaced with a copy of their own before they are edited in place, so that the other links (e.g.,
+                    // the system's files) are left alone
+                    // returns false if the file could not be replaced
+                    bool breakHardlinks() {
+                        struct stat statData{};
+
+                        if (stat(path.c_str(), &statData) != 0) {
+                            ldLog() << LD_ERROR << "Could not stat file:" << path << std::endl;
+                            return false;
+                        }
+
+                        if (statData.st_nlink <= 1)
+                            return true;
+
+                        ldLog() << LD_DEBUG << "File has" << static_cast<size_t>(statData.st_nlink) << "hardlinks, replacing it with a copy before modifying it:" << path << std::endl;
+
+                        if (!writePatchedCopy(path, {}))
+                            return false;
+
+                        load();
+                        return true;
+                    }
+
+                    // replace the rpath without changing the layout of the file (see planRPathPatches())
+                    // returns false if the file could not be edited in place
+                    bool setRPathInPlace(const std::string& value) {
+                        std::vector<FilePatch> patches;
+
+                        if (!planRPathPatches(value, patches))
+                            return false;
+
+                        auto fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+
+                        if (fd < 0) {
+                            ldLog() << LD_ERROR << "Could not open file for writing:" << path << std::endl;
+                            return false;
+                        }
+
+                        bool success = applyPatches(fd, patches);
+
+                        if (close(fd) != 0)
+                            success = false;
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to write rpath to file:" << path << std::endl;
+                            return false;
+                        }
+
+                        // make sure the new values are read from the file
+                        load();
+
+                        return true;
+                    }
+
+                private:
+                    // whether a section only contains symbols or debug information, which are not needed at runtime
+                    static bool isStrippableSection(const Section& section) {
+                        if ((section.flags & SHF_ALLOC) != 0)
+                            return false;
+
+                        return section.type == SHT_SYMTAB || section.name == ".strtab" ||
+                               util::stringStartsWith(section.name, ".debug_") ||
+                               util::stringStartsWith(section.name, ".zdebug_");
+                    }
+
+                    // write the given data to a file descriptor, retrying on short writes
+                    static bool writeAll(int fd, const void* buffer, uint64_t length) {
+                        const auto* current = static_cast<const char*>(buffer);
+
+                        while (length > 0) {
+                            auto written = write(fd, current, static_cast<size_t>(std::min<uint64_t>(length, 1 << 24)));
+
+                            if (written < 0) {
+                                if (errno == EINTR)
+                                    continue;
+                                return false;
+                            }
+
+                            current += written;
+                            length -= static_cast<uint64_t>(written);
+                        }
+
+                        return true;
+                    }
+
+                    // pad the output with null bytes until the given offset is reached
+                    static bool writePadding(int fd, uint64_t& position, uint64_t alignment) {
+                        static const char zeros[64] = {};
+
+                        if (alignment <= 1)
+                            return true;
+
+                        while (position % alignment != 0) {
+                            auto length = std::min<uint64_t>(alignment - position % alignment, sizeof(zeros));
+
+                            if (!writeAll(fd, zeros, length))
+                                return false;
+
+                            position += length;
+                        }
+
+                        return true;
+                    }
+
+                    // create a temporary file next to path, which is renamed to path once it has been written
+                    // returns -1 on failure
+                    static int createTemporaryFile(const bf::path& path, std::string& temporaryPath) {
+                        // the name is recognizable, so that files left behind by interrupted runs can be removed
+                        temporaryPath = path.string() + ".linuxdeploy-tmp.XXXXXX";
+                        std::vector<char> temporaryPathBuffer(temporaryPath.begin(), temporaryPath.end());
+                        temporaryPathBuffer.push_back('\0');
+
+                        auto fd = mkstemp(temporaryPathBuffer.data());
+
+                        if (fd >= 0)
+                            temporaryPath = temporaryPathBuffer.data();
+
+                        return fd;
+                    }
+
+                    // write an unmodified copy of the file with the patches applied to outputPath
+                    bool writePatchedCopy(const bf::path& outputPath, const std::vector<FilePatch>& patches) {
+                        struct stat statData{};
+
+                        if (stat(path.c_str(), &statData) != 0) {
+                            ldLog() << LD_ERROR << "Could not stat file:" << path << std::endl;
+                            return false;
+                        }
+
+                        std::string temporaryPath;
+                        auto fd = createTemporaryFile(outputPath, temporaryPath);
+
+                        if (fd < 0) {
+                            ldLog() << LD_ERROR << "Could not create temporary file for copying:" << outputPath << std::endl;
+                            return false;
+                        }
+
+                        bool success = fchmod(fd, statData.st_mode & 07777) == 0 && writeAll(fd, data, size) && applyPatches(fd, patches);
+
+                        if (close(fd) != 0)
+                            success = false;
+
+                        if (success && rename(temporaryPath.c_str(), outputPath.c_str()) != 0)
+                            success = false;
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to write file:" << outputPath << std::endl;
+                            unlink(temporaryPath.c_str());
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // the stripped file is written to outputPath, which replaces the file itself if it is the file's
+                    // path, with the patches applied
+                    // if the file doesn't have to or can't be stripped, nothing is written, and written is left unchanged
+                    template<typename Ehdr, typename Shdr>
+                    bool strip(uint64_t& bytesRemoved, const bf::path& outputPath, const std::vector<FilePatch>& patches, bool& written) {
+                        parseSectionHeaders();
+
+                        if (elfType != ET_EXEC && elfType != ET_DYN) {
+                            ldLog() << LD_WARNING << "Not stripping file which is neither an executable nor a shared library:" << path << std::endl;
+                            return true;
+                        }
+
+                        if (sections.empty())
+                            return true;
+
+                        Ehdr header{};
+                        readStruct(0, header);
+
+                        const uint16_t originalSectionCount = convert(header.e_shnum);
+                        const uint16_t originalSectionNamesIndex = convert(header.e_shstrndx);
+                        const uint64_t sectionNamesIndex = originalSectionNamesIndex == SHN_XINDEX ? sections[0].link : originalSectionNamesIndex;
+
+                        // everything the loader needs lies within the segments and the headers, which are copied as-is
+                        // the sections after that are not needed at runtime, and can be moved around freely
+                        uint64_t tailOffset = std::max<uint64_t>(sizeof(Ehdr), convert(header.e_phoff) + static_cast<uint64_t>(convert(header.e_phentsize)) * convert(header.e_phnum));
+
+                        for (const auto& segment : segments)
+                            tailOffset = std::max(tailOffset, segment.offset + segment.fileSize);
+
+                        if (tailOffset > size)
+                            return false;
+
+                        // the patches are applied to the data which is copied as-is
+                        for (const auto& patch : patches) {
+                            if (patch.offset < sizeof(Ehdr) || patch.offset > tailOffset || patch.data.size() > tailOffset - patch.offset)
+                                return false;
+                        }
+
+                        std::vector<bool> removed(sections.size(), false);
+                        bool changed = false;
+
+                        for (size_t i = 1; i < sections.size(); i++) {
+                            if (i != sectionNamesIndex && isStrippableSection(sections[i])) {
+                                removed[i] = true;
+                                changed = true;
+                            }
+                        }
+
+                        if (!changed)
+                            return true;
+
+                        // sections linked to removed ones (e.g., relocations for debug information, or extended
+                        // section indices for the symbol table) are useless as well
+                        // loaded sections which depend on removed ones indicate an unusual layout, which is left alone
+                        for (bool repeat = true; repeat;) {
+                            repeat = false;
+
+                            for (size_t i = 1; i < sections.size(); i++) {
+                                if (removed[i])
+                                    continue;
+
+                                const auto& section = sections[i];
+
+                                const bool infoIsSectionIndex = (section.flags & SHF_INFO_LINK) != 0 || section.type == SHT_REL || section.type == SHT_RELA;
+
+                                const bool linkedToRemovedSection = (section.link < sections.size() && removed[section.link]) ||
+                                                                    (infoIsSectionIndex && section.info < sections.size() && removed[section.info]);
+
+                                if (!linkedToRemovedSection)
+                                    continue;
+
+                                if ((section.flags & SHF_ALLOC) != 0 || i == sectionNamesIndex) {
+                                    ldLog() << LD_WARNING << "Cannot strip file, section" << section.name << "depends on removable sections:" << path << std::endl;
+                                    return true;
+                                }
+
+                                removed[i] = true;
+                                repeat = true;
+                            }
+                        }
+
+                        // the dynamic symbols refer to the sections by index, therefore the indices of the loaded
+                        // sections must not change
+                        size_t firstRemovedIndex = sections.size();
+
+                        for (size_t i = 0; i < sections.size(); i++) {
+                            if (removed[i]) {
+                                firstRemovedIndex = std::min(firstRemovedIndex, i);
+                            } else if ((sections[i].flags & SHF_ALLOC) != 0 && i > firstRemovedIndex) {
+                                ldLog() << LD_WARNING << "Cannot strip file, loaded sections follow removable ones:" << path << std::endl;
+                                return true;
+                            }
+                        }
+
+                        // the section indices of the remaining sections
+                        std::vector<uint64_t> newIndices(sections.size(), 0);
+                        std::vector<Section> keptSections;
+                        std::vector<uint64_t> originalOffsets;
+
+                        for (size_t i = 0; i < sections.size(); i++) {
+                            if (removed[i])
+                                continue;
+
+                            newIndices[i] = keptSections.size();
+                            keptSections.push_back(sections[i]);
+                            originalOffsets.push_back(sections[i].offset);
+                        }
+
+                        // make sure no data is lost, e.g., payloads appended to the file which are not covered by any
+                        // section
+                        std::vector<std::pair<uint64_t, uint64_t>> coveredRanges;
+
+                        for (const auto& section : sections) {
+                            if (section.type == SHT_NOBITS || section.offset < tailOffset)
+                                continue;
+
+                            if (!isInFile(section.offset, section.size))
+                                return false;
+
+                            coveredRanges.emplace_back(section.offset, section.offset + section.size);
+                        }
+
+                        const uint64_t sectionHeadersOffset = convert(header.e_shoff);
+                        const uint64_t sectionHeaderSize = convert(header.e_shentsize);
+                        coveredRanges.emplace_back(sectionHeadersOffset, sectionHeadersOffset + sectionHeaderSize * sections.size());
+                        std::sort(coveredRanges.begin(), coveredRanges.end());
+
+                        uint64_t checkedOffset = tailOffset;
+
+                        for (const auto& range : coveredRanges) {
+                            for (; checkedOffset < std::min<uint64_t>(range.first, size); checkedOffset++) {
+                                if (data[checkedOffset] != 0) {
+                                    ldLog() << LD_WARNING << "Cannot strip file, it contains data outside of any section:" << path << std::endl;
+                                    return true;
+                                }
+                            }
+
+                            checkedOffset = std::max(checkedOffset, range.second);
+                        }
+
+                        for (; checkedOffset < size; checkedOffset++) {
+                            if (data[checkedOffset] != 0) {
+                                ldLog() << LD_WARNING << "Cannot strip file, it contains data outside of any section:" << path << std::endl;
+                                return true;
+                            }
+                        }
+
+                        // calculate the new layout: the sections after the segments are moved towards the beginning of
+                        // the file, followed by the section headers
+                        uint64_t outputSize = tailOffset;
+
+                        for (size_t i = 1; i < keptSections.size(); i++) {
+                            auto& section = keptSections[i];
+
+                            if (section.offset < tailOffset)
+                                continue;
+
+                            if (section.addressAlignment > 1)
+                                outputSize = (outputSize + section.addressAlignment - 1) / section.addressAlignment * section.addressAlignment;
+
+                            section.offset = outputSize;
+
+                            if (section.type != SHT_NOBITS)
+                                outputSize += section.size;
+                        }
+
+                        const uint64_t sectionHeadersAlignment = alignof(Shdr);
+                        outputSize = (outputSize + sectionHeadersAlignment - 1) / sectionHeadersAlignment * sectionHeadersAlignment;
+                        const uint64_t newSectionHeadersOffset = outputSize;
+
+                        // update the references to section indices
+                        for (size_t i = 1; i < keptSections.size(); i++) {
+                            auto& section = keptSections[i];
+
+                            if (section.link < sections.size())
+                                section.link = static_cast<uint32_t>(newIndices[section.link]);
+
+                            if (((section.flags & SHF_INFO_LINK) != 0 || section.type == SHT_REL || section.type == SHT_RELA) &&
+                                section.info < sections.size()) {
+                                section.info = static_cast<uint32_t>(newIndices[section.info]);
+                            }
+                        }
+
+                        const uint64_t newSectionNamesIndex = newIndices[sectionNamesIndex];
+
+                        // large numbers are stored in the first section header
+                        if (originalSectionCount == 0)
+                            keptSections[0].size = 0;
+                        if (originalSectionNamesIndex == SHN_XINDEX)
+                            keptSections[0].link = 0;
+
+                        if (keptSections.size() >= SHN_LORESERVE) {
+                            header.e_shnum = 0;
+                            keptSections[0].size = keptSections.size();
+                        } else {
+                            header.e_shnum = convert(static_cast<uint16_t>(keptSections.size()));
+                        }
+
+                        if (newSectionNamesIndex >= SHN_LORESERVE) {
+                            header.e_shstrndx = convert(static_cast<uint16_t>(SHN_XINDEX));
+                            keptSections[0].link = static_cast<uint32_t>(newSectionNamesIndex);
+                        } else {
+                            header.e_shstrndx = convert(static_cast<uint16_t>(newSectionNamesIndex));
+                        }
+
+                        header.e_shoff = convert(static_cast<decltype(header.e_shoff)>(newSectionHeadersOffset));
+                        header.e_shentsize = convert(static_cast<uint16_t>(sizeof(Shdr)));
+
+                        // the result is written to a temporary file next to the original one, which then replaces the
+                        // original file
+                        struct stat statData{};
+
+                        if (stat(path.c_str(), &statData) != 0) {
+                            ldLog() << LD_ERROR << "Could not stat file:" << path << std::endl;
+                            return false;
+                        }
+
+                        std::string temporaryPath;
+                        auto fd = createTemporaryFile(outputPath, temporaryPath);
+
+                        if (fd < 0) {
+                            ldLog() << LD_ERROR << "Could not create temporary file for stripping:" << outputPath << std::endl;
+                            return false;
+                        }
+
+                        bool success = fchmod(fd, statData.st_mode & 07777) == 0;
+
+                        // only the ranges which are kept are written, the file never has to be buffered in memory
+                        uint64_t position = 0;
+
+                        success = success && writeAll(fd, &header, sizeof(header));
+                        position += sizeof(header);
+
+                        success = success && writeAll(fd, data + position, tailOffset - position);
+                        position = tailOffset;
+
+                        for (size_t i = 1; success && i < keptSections.size(); i++) {
+                            const auto& section = keptSections[i];
+
+                            if (section.offset < tailOffset)
+                                continue;
+
+                            success = writePadding(fd, position, section.addressAlignment);
+
+                            if (section.type == SHT_NOBITS)
+                                continue;
+
+                            success = success && writeAll(fd, data + originalOffsets[i], section.size);
+                            position += section.size;
+                        }
+
+                        success = success && writePadding(fd, position, sectionHeadersAlignment);
+
+                        for (size_t i = 0; success && i < keptSections.size(); i++) {
+                            const auto& section = keptSections[i];
+
+                            Shdr sectionHeader{};
+                            sectionHeader.sh_name = convert(section.nameIndex);
+                            sectionHeader.sh_type = convert(section.type);
+                            sectionHeader.sh_flags = convert(static_cast<decltype(sectionHeader.sh_flags)>(section.flags));
+                            sectionHeader.sh_addr = convert(static_cast<decltype(sectionHeader.sh_addr)>(section.address));
+                            sectionHeader.sh_offset = convert(static_cast<decltype(sectionHeader.sh_offset)>(section.offset));
+                            sectionHeader.sh_size = convert(static_cast<decltype(sectionHeader.sh_size)>(section.size));
+                            sectionHeader.sh_link = convert(section.link);
+                            sectionHeader.sh_info = convert(section.info);
+                            sectionHeader.sh_addralign = convert(static_cast<decltype(sectionHeader.sh_addralign)>(section.addressAlignment));
+                            sectionHeader.sh_entsize = convert(static_cast<decltype(sectionHeader.sh_entsize)>(section.entrySize));
+
+                            success = writeAll(fd, &sectionHeader, sizeof(sectionHeader));
+                            position += sizeof(sectionHeader);
+                        }
+
+                        success = success && applyPatches(fd, patches);
+
+                        if (close(fd) != 0)
+                            success = false;
+
+                        if (success && rename(temporaryPath.c_str(), outputPath.c_str()) != 0)
+                            success = false;
+
+                        if (!success) {
+                            ldLog() << LD_ERROR << "Failed to write stripped file:" << outputPath << std::endl;
+                            unlink(temporaryPath.c_str());
+                            return false;
+                        }
+
+                        bytesRemoved = size > position ? size - position : 0;
+                        written = true;
+
+                        // the mapping still refers to the original file
+                        if (outputPath == path)
+                            load();
+
+                        return true;
+                    }
 
                 public:
+                    // names of the interpreter which is loaded before any of the dependencies
+                    // maps the file name and the soname of the interpreter to its path
+                    // interpreter is the interpreter requested by the file, if any
+                    // must not be called while holding the lock of any file
+                    static std::map<std::string, bf::path> getInterpreterNames(std::string interpreter, uint8_t elfClass, uint16_t elfMachine);
+
+                    // collect the information needed to search for the dependencies of the file
+                    // filePath is the path used to load the file, which is used to expand $ORIGIN
+                    libraryresolver::SearchContext createSearchContext(const bf::path& filePath, const std::vector<std::string>& loaderRPathDirectories);
+
+                    bool strip(uint64_t& bytesRemoved, const bf::path& outputPath, const std::vector<FilePatch>& patches, bool& written) {
+                        bytesRemoved = 0;
+
+                        try {
+                            if (elfClass == ELFCLASS32)
+                                return strip<Elf32_Ehdr, Elf32_Shdr>(bytesRemoved, outputPath, patches, written);
+
+                            return strip<Elf64_Ehdr, Elf64_Shdr>(bytesRemoved, outputPath, patches, written);
+                        } catch (const ElfFileParseError& e) {
+                            ldLog() << LD_ERROR << "Could not strip file" << path << LD_NO_SPACE << ":" << e.what() << std::endl;
+                            return false;
+                        }
+                    }
+
+                    bool strip(uint64_t& bytesRemoved) {
+                        bool written = false;
+                        return strip(bytesRemoved, path, {}, written);
+                    }
+
+                    // whether strip() would remove any sections from the file
+                    bool hasStrippableSections() {
+                        parseSectionHeaders();
+
+                        if ((elfType != ET_EXEC && elfType != ET_DYN) || sections.empty())
+                            return false;
+
+                        uint64_t sectionNamesIndex = elfClass == ELFCLASS32 ? readValue<uint16_t>(offsetof(Elf32_Ehdr, e_shstrndx))
+                                                                            : readValue<uint16_t>(offsetof(Elf64_Ehdr, e_shstrndx));
+
+                        if (sectionNamesIndex == SHN_XINDEX)
+                            sectionNamesIndex = sections[0].link;
+
+                        for (size_t i = 1; i < sections.size(); i++) {
+                            if (i != sectionNamesIndex && isStrippableSection(sections[i]))
+                                return true;
+                        }
+
+                        return false;
+                    }
+
+                    // write a copy of the file, stripped and with the new rpath if requested, to outputPath at once
+                    // if the new rpath doesn't fit into the file, the copy is written without it, and rpathSet is false
+                    bool writeTransformedCopy(const bf::path& outputPath, bool stripFile, bool setRPath, const std::string& rpath,
+                                              bool& rpathSet, uint64_t& bytesRemoved) {
+                        std::vector<FilePatch> patches;
+
+                        rpathSet = false;
+                        bytesRemoved = 0;
+
+                        if (setRPath) {
+                            try {
+                                rpathSet = planRPathPatches(rpath, patches);
+                            } catch (const ElfFileParseError& e) {
+                                ldLog() << LD_DEBUG << "Cannot update rpath in place:" << e.what() << std::endl;
+                            }
+
+                            if (!rpathSet)
+                                patches.clear();
+                        }
+
+                        if (stripFile) {
+                            bool written = false;
+
+                            if (!strip(bytesRemoved, outputPath, patches, written))
+                                return false;
+
+                            if (written)
+                                return true;
+                        }
+
+                        return writePatchedCopy(outputPath, patches);
+                    }
+
                     static std::string getPatchelfPath() {
                         // by default, try to use a patchelf next to the linuxdeploy binary
                         // if that isn't available, fall back to searching for patchelf in the PATH
@@ -42,115 +1478,318 @@ namespace linuxdeploy {
                     }
             };
 
+            std::mutex ElfFile::PrivateData::registryMutex;
+            std::map<std::string, std::shared_ptr<ElfFile::PrivateData>> ElfFile::PrivateData::registry;
+
             ElfFile::ElfFile(const boost::filesystem::path& path) {
-                // check if file exists
-                if (!bf::exists(path))
-                    throw ElfFileParseError("No such file or directory: " + path.string());
+                // maps the file and checks the magic bytes and headers, unless that has been done already
+                d = PrivateData::getShared(path);
+            }
+
+            ElfFile::~ElfFile() = default;
+
+            void ElfFile::clearRegistry() {
+                PrivateData::clearRegistry();
+            }
+
+            ElfFileType ElfFile::probeFileType(const bf::path& path) {
+                auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                if (fd < 0)
+                    return ELF_FILE_TYPE_NONE;
+
+                auto type = ELF_FILE_TYPE_NONE;
+
+                struct stat statData{};
+                unsigned char ident[EI_NIDENT];
+
+                if (fstat(fd, &statData) == 0 && S_ISREG(statData.st_mode) && statData.st_size >= EI_NIDENT &&
+                    pread(fd, ident, EI_NIDENT, 0) == EI_NIDENT && memcmp(ident, ELFMAG, SELFMAG) == 0) {
+                    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                    const bool swap = ident[EI_DATA] == ELFDATA2MSB;
+                    #else
+                    const bool swap = ident[EI_DATA] == ELFDATA2LSB;
+                    #endif
 
-                // check magic bytes
-                std::ifstream ifs(path.string());
-                if (!ifs)
-                    throw ElfFileParseError("Could not open file: " + path.string());
+                    const HeaderProbe probe(fd, static_cast<uint64_t>(statData.st_size), swap);
 
-                std::vector<char> magicBytes(4);
-                ifs.read(magicBytes.data(), 4);
+                    if (ident[EI_DATA] == ELFDATA2LSB || ident[EI_DATA] == ELFDATA2MSB) {
+                        if (ident[EI_CLASS] == ELFCLASS32)
+                            type = probe.probe<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>();
+                        else if (ident[EI_CLASS] == ELFCLASS64)
+                            type = probe.probe<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>();
+                    }
+                }
+
+                close(fd);
+
+                return type;
+            }
+
+            std::map<std::string, bf::path> ElfFile::PrivateData::getInterpreterNames(std::string interpreter, uint8_t elfClass, uint16_t elfMachine) {
+                std::map<std::string, bf::path> names;
+
+                // libraries don't specify an interpreter, ldd uses the system's default one then
+                // our own interpreter is the best guess for that, provided it's compatible
+                if (interpreter.empty()) {
+                    try {
+                        ElfFile ownExecutable(util::getOwnExecutablePath());
+                        std::lock_guard<std::recursive_mutex> lock(ownExecutable.d->mutex);
+
+                        if (ownExecutable.d->elfClass == elfClass && ownExecutable.d->elfMachine == elfMachine)
+                            interpreter = ownExecutable.d->getInterpreter();
+                    } catch (const ElfFileParseError&) {}
+                }
+
+                if (interpreter.empty())
+                    return names;
+
+                names[bf::path(interpreter).filename().string()] = interpreter;
+
+                try {
+                    ElfFile interpreterFile(interpreter);
+                    std::lock_guard<std::recursive_mutex> lock(interpreterFile.d->mutex);
+                    auto soname = interpreterFile.d->getDynamicString(DT_SONAME);
 
-                if (strncmp(magicBytes.data(), "\177ELF", 4) != 0)
-                    throw ElfFileParseError("Invalid magic bytes in file header");
+                    if (!soname.empty())
+                        names[soname] = interpreter;
+                } catch (const ElfFileParseError& e) {
+                    ldLog() << LD_DEBUG << "Could not parse interpreter" << interpreter << LD_NO_SPACE << ":" << e.what() << std::endl;
+                }
 
-                d = new PrivateData(path);
+                return names;
             }
 
-            ElfFile::~ElfFile() {
-                delete d;
+            libraryresolver::SearchContext ElfFile::PrivateData::createSearchContext(const bf::path& filePath, const std::vector<std::string>& loaderRPathDirectories) {
+                // $ORIGIN refers to the directory containing the file
+                // like ldd, the path is not resolved, therefore symlinks to the file won't be followed
+                auto origin = bf::absolute(filePath).parent_path();
+
+                libraryresolver::SearchContext context;
+                context.elfClass = elfClass;
+                context.elfMachine = elfMachine;
+                context.hasRunPath = hasDynamicEntry(DT_RUNPATH);
+
+                // the DT_RPATH entries are ignored for files which have a DT_RUNPATH entry, but apply to the
+                // dependencies of the file as well
+                if (!context.hasRunPath) {
+                    for (const auto& rpath : getDynamicStrings(DT_RPATH)) {
+                        auto directories = libraryresolver::LibraryResolver::expandSearchPath(rpath, origin, elfClass);
+                        context.rpathDirectories.insert(context.rpathDirectories.end(), directories.begin(), directories.end());
+                    }
+                }
+
+                context.rpathDirectories.insert(context.rpathDirectories.end(), loaderRPathDirectories.begin(), loaderRPathDirectories.end());
+
+                for (const auto& runpath : getDynamicStrings(DT_RUNPATH)) {
+                    context.runpathDirectories = libraryresolver::LibraryResolver::expandSearchPath(runpath, origin, elfClass);
+                }
+
+                return context;
             }
 
             std::vector<bf::path> ElfFile::traceDynamicDependencies() {
                 // this method's purpose is to abstract this process
                 // the caller doesn't care _how_ it's done, after all
 
-                // for now, we use the same ldd based method linuxdeployqt uses
+                // the dependencies are resolved like the dynamic linker does it: the files are processed in
+                // breadth-first order, and every library is loaded once only, no matter how many files depend on it
+
+                auto& resolver = libraryresolver::LibraryResolver::getInstance();
 
                 std::vector<bf::path> paths;
 
-                subprocess::Popen lddProc(
-                    {"ldd", d->path.string().c_str()},
-                    subprocess::output{subprocess::PIPE},
-                    subprocess::error{subprocess::PIPE}
-                );
-
-                auto lddOutput = lddProc.communicate();
-                auto& lddStdout = lddOutput.first;
-                auto& lddStderr = lddOutput.second;
-
-                if (lddProc.retcode() != 0) {
-                    ldLog() << LD_ERROR << "Call to ldd failed:" << std::endl << lddStderr.buf.data() << std::endl;
-                    return {};
-                }
-
-                std::string lddStdoutContents(lddStdout.buf.data());
-
-                const boost::regex expr(R"(\s*(.+)\s+\=>\s+(.+)\s+\((.+)\)\s*)");
-                boost::smatch what;
-
-                for (const auto& line : util::splitLines(lddStdoutContents)) {
-                    if (boost::regex_search(line, what, expr)) {
-                        auto libraryPath = what[2].str();
-                        util::trim(libraryPath);
-                        paths.push_back(bf::absolute(libraryPath));
-                    } else {
-                        if (util::stringContains(line, "not found")) {
-                            auto missingLib = line;
-                            static const std::string pattern = "=> not found";
-                            missingLib.erase(missingLib.find(pattern), pattern.size());
-                            util::trim(missingLib);
-                            util::trim(missingLib, '\t');
-                            throw DependencyNotFoundError("Could not find dependency: " + missingLib);
-                        } else {
-                            ldLog() << LD_DEBUG << "Invalid ldd output: " << line << std::endl;
+                // the locks of the files are held only while their data is read, as searching for the libraries
+                // requires opening other files
+                bf::path rootPath;
+                std::string interpreter;
+                uint8_t elfClass;
+                uint16_t elfMachine;
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(d->mutex);
+                    rootPath = d->path;
+                    interpreter = d->getInterpreter();
+                    elfClass = d->elfClass;
+                    elfMachine = d->elfMachine;
+                }
+
+                // maps the names of the libraries that have been loaded (sonames and the names used to request them)
+                // to the paths of the files
+                // the interpreter is loaded already when the dependencies are resolved, and isn't listed by ldd either
+                std::map<std::string, bf::path> loadedLibraries = PrivateData::getInterpreterNames(interpreter, elfClass, elfMachine);
+                std::set<bf::path> loadedFiles;
+
+                struct QueueEntry {
+                    bf::path path;
+
+                    // the DT_RPATH directories of the files which loaded this file
+                    std::vector<std::string> loaderRPathDirectories;
+                };
+
+                std::deque<QueueEntry> queue;
+                queue.push_back({rootPath, {}});
+                loadedFiles.insert(bf::absolute(rootPath));
+
+                bool isRoot = true;
+
+                for (; !queue.empty(); isRoot = false) {
+                    const auto entry = queue.front();
+                    queue.pop_front();
+
+                    // avoid parsing the root file again
+                    std::unique_ptr<ElfFile> dependency;
+                    if (!isRoot)
+                        dependency.reset(new ElfFile(entry.path));
+
+                    auto* file = isRoot ? this : dependency.get();
+
+                    libraryresolver::SearchContext context;
+                    std::vector<std::string> neededLibraries;
+
+                    {
+                        std::lock_guard<std::recursive_mutex> lock(file->d->mutex);
+
+                        if (!isRoot) {
+                            auto soname = file->d->getDynamicString(DT_SONAME);
+
+                            if (!soname.empty() && loadedLibraries.find(soname) == loadedLibraries.end())
+                                loadedLibraries[soname] = entry.path;
                         }
+
+                        context = file->d->createSearchContext(entry.path, entry.loaderRPathDirectories);
+                        neededLibraries = file->d->getDynamicStrings(DT_NEEDED);
+                    }
+
+                    // all files in the tree must match the class and machine of the root file
+                    context.elfClass = elfClass;
+                    context.elfMachine = elfMachine;
+
+                    for (const auto& neededLibrary : neededLibraries) {
+                        if (loadedLibraries.find(neededLibrary) != loadedLibraries.end())
+                            continue;
+
+                        auto libraryPath = resolver.findLibrary(neededLibrary, context);
+
+                        if (libraryPath.empty())
+                            throw DependencyNotFoundError("Could not find dependency: " + neededLibrary);
+
+                        loadedLibraries[neededLibrary] = libraryPath;
+
+                        // the same file might be requested using different names
+                        if (!loadedFiles.insert(libraryPath).second)
+                            continue;
+
+                        paths.push_back(libraryPath);
+                        queue.push_back({libraryPath, context.rpathDirectories});
                     }
                 }
 
                 return paths;
             }
 
+            std::vector<bf::path> ElfFile::resolveNeededLibraries(const std::vector<std::string>& loaderRPathDirectories,
+                                                                  std::vector<std::string>* rpathDirectories) {
+                auto& resolver = libraryresolver::LibraryResolver::getInstance();
+
+                std::vector<bf::path> paths;
+
+                // like in traceDynamicDependencies(), the lock must not be held while searching for the libraries
+                std::string interpreter;
+                libraryresolver::SearchContext context;
+                std::vector<std::string> neededLibraries;
+                std::set<bf::path> resolvedFiles;
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(d->mutex);
+                    interpreter = d->getInterpreter();
+                    context = d->createSearchContext(d->path, loaderRPathDirectories);
+                    neededLibraries = d->getDynamicStrings(DT_NEEDED);
+                    resolvedFiles.insert(bf::absolute(d->path));
+                }
+
+                // the interpreter is always loaded, see traceDynamicDependencies()
+                const auto interpreterNames = PrivateData::getInterpreterNames(interpreter, context.elfClass, context.elfMachine);
+
+                for (const auto& neededLibrary : neededLibraries) {
+                    if (interpreterNames.find(neededLibrary) != interpreterNames.end())
+                        continue;
+
+                    auto libraryPath = resolver.findLibrary(neededLibrary, context);
+
+                    if (libraryPath.empty())
+                        throw DependencyNotFoundError("Could not find dependency: " + neededLibrary);
+
+                    if (resolvedFiles.insert(libraryPath).second)
+                        paths.push_back(libraryPath);
+                }
+
+                if (rpathDirectories != nullptr)
+                    *rpathDirectories = context.rpathDirectories;
+
+                return paths;
+            }
+
+            std::vector<std::string> ElfFile::getNeededLibraries() {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+                return d->getDynamicStrings(DT_NEEDED);
+            }
+
+            uint8_t ElfFile::getElfClass() {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+                return d->elfClass;
+            }
+
+            uint16_t ElfFile::getElfMachine() {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+                return d->elfMachine;
+            }
+
             std::string ElfFile::getRPath() {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                // like patchelf --print-rpath, DT_RUNPATH is preferred over DT_RPATH, as the latter is ignored by the
+                // dynamic linker if the former exists
                 try {
-                    subprocess::Popen patchelfProc(
-                        {d->getPatchelfPath().c_str(), "--print-rpath", d->path.c_str()},
-                        subprocess::output(subprocess::PIPE),
-                        subprocess::error(subprocess::PIPE)
-                    );
+                    for (const auto tag : {DT_RUNPATH, DT_RPATH}) {
+                        auto values = d->getDynamicStrings(tag);
 
-                    auto patchelfOutput = patchelfProc.communicate();
-                    auto& patchelfStdout = patchelfOutput.first;
-                    auto& patchelfStderr = patchelfOutput.second;
+                        if (!values.empty())
+                            return values.front();
+                    }
+                } catch (const ElfFileParseError& e) {
+                    ldLog() << LD_ERROR << "Failed to read rpath from ELF file" << d->path << LD_NO_SPACE << ":" << e.what() << std::endl;
+                }
 
-                    if (patchelfProc.retcode() != 0) {
-                        std::string errStr(patchelfStderr.buf.data());
+                return "";
+            }
 
-                        // if file is not an ELF executable, there is no need for a detailed error message
-                        if (patchelfProc.retcode() == 1 && errStr.find("not an ELF executable")) {
-                            return "";
-                        } else {
-                            ldLog() << LD_ERROR << "Call to patchelf failed:" << std::endl << errStr;
-                            return "";
-                        }
-                    }
+            bool ElfFile::setRPath(const std::string& value, RPathUpdateMethod* method) {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                // both the rpath is updated in place and patchelf rewrites the file, which must not modify other links to it
+                try {
+                    if (!d->breakHardlinks())
+                        return false;
+                } catch (const ElfFileParseError& e) {
+                    ldLog() << LD_ERROR << "Failed to reload file" << d->path << LD_NO_SPACE << ":" << e.what() << std::endl;
+                    return false;
+                }
 
+                try {
+                    if (d->setRPathInPlace(value)) {
+                        ldLog() << LD_DEBUG << "Updated rpath in place:" << d->path << std::endl;
 
-                    std::string retval = patchelfStdout.buf.data();
-                    util::trim(retval, '\n');
-                    util::trim(retval);
+                        if (method != nullptr)
+                            *method = RPATH_UPDATED_IN_PLACE;
 
-                    return retval;
-                } catch (const std::exception&) {
-                    return "";
+                        return true;
+                    }
+                } catch (const ElfFileParseError& e) {
+                    ldLog() << LD_DEBUG << "Cannot update rpath in place:" << e.what() << std::endl;
                 }
-            }
 
-            bool ElfFile::setRPath(const std::string& value) {
+                // the string table has to grow, which requires moving sections around
                 try {
                     subprocess::Popen patchelfProc(
                         {d->getPatchelfPath().c_str(), "--set-rpath", value.c_str(), d->path.c_str()},
@@ -159,7 +1798,6 @@ namespace linuxdeploy {
                     );
 
                     auto patchelfOutput = patchelfProc.communicate();
-                    auto& patchelfStdout = patchelfOutput.first;
                     auto& patchelfStderr = patchelfOutput.second;
 
                     if (patchelfProc.retcode() != 0) {
@@ -170,6 +1808,72 @@ namespace linuxdeploy {
                     return false;
                 }
 
+                if (method != nullptr)
+                    *method = RPATH_UPDATED_WITH_PATCHELF;
+
+                // patchelf rewrites the entire file, the old mapping must not be used any more
+                try {
+                    d->load();
+                } catch (const ElfFileParseError& e) {
+                    ldLog() << LD_ERROR << "Failed to reload file modified by patchelf:" << e.what() << std::endl;
+                    return false;
+                }
+
+                return true;
+            }
+
+            bool ElfFile::isStripped() {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                try {
+                    return !d->hasStrippableSections();
+                } catch (const ElfFileParseError&) {
+                    return false;
+                }
+            }
+
+            bool ElfFile::hasRPath(const std::string& value) {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                // setRPath() converts DT_RPATH entries to DT_RUNPATH, therefore only the latter are considered
+                try {
+                    const auto values = d->getDynamicStrings(DT_RUNPATH);
+                    return !values.empty() && values.front() == value;
+                } catch (const ElfFileParseError&) {
+                    return false;
+                }
+            }
+
+            bool ElfFile::writeTransformedCopy(const bf::path& destination, bool strip, bool setRPath, const std::string& rpath,
+                                               bool* rpathSet, uint64_t* bytesRemoved) {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                bool set = false;
+                uint64_t removed = 0;
+
+                if (!d->writeTransformedCopy(destination, strip, setRPath, rpath, set, removed))
+                    return false;
+
+                if (rpathSet != nullptr)
+                    *rpathSet = set;
+
+                if (bytesRemoved != nullptr)
+                    *bytesRemoved = removed;
+
+                return true;
+            }
+
+            bool ElfFile::strip(uint64_t* bytesRemoved) {
+                std::lock_guard<std::recursive_mutex> lock(d->mutex);
+
+                uint64_t removed = 0;
+
+                if (!d->strip(removed))
+                    return false;
+
+                if (bytesRemoved != nullptr)
+                    *bytesRemoved = removed;
+
                 return true;
             }
         }
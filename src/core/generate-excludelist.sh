@@ -39,13 +39,37 @@ cat > "$filename" <<EOF
 #include <string>
 #include <vector>
 
-static const std::vector<std::string> generatedExcludelist = {
 EOF
 
-# Create array
-for item in ${blacklisted[@]:0:${#blacklisted[@]}-1}; do
-    echo -e '    "'"$item"'",' >> "$filename"
+# the entries are split into names, which are looked up in a hash table, and wildcard patterns, which are compiled into
+# an automaton (see patternmatcher.h)
+names=()
+patterns=()
+
+for item in "${blacklisted[@]}"; do
+    case "$item" in
+        *[\\*?[]*)
+            patterns+=("$item")
+            ;;
+        *)
+            names+=("$item")
+            ;;
+    esac
 done
-echo -e '    "'"${blacklisted[$((${#blacklisted[@]}-1))]}"'"' >> "$filename"
 
-echo "};" >> "$filename"
+# write array of strings
+# usage: write_array <name> <items...>
+write_array() {
+    echo "static const std::vector<std::string> $1 = {" >> "$filename"
+    shift
+
+    for item in "$@"; do
+        echo '    "'"$item"'",' >> "$filename"
+    done
+
+    echo "};" >> "$filename"
+}
+
+write_array generatedExcludelistNames "${names[@]}"
+echo >> "$filename"
+write_array generatedExcludelistPatterns "${patterns[@]}"
@@ -0,0 +1,274 @@
+// system headers
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+// library headers
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+
+// local headers
+#include "linuxdeploy/core/ldcache.h"
+#include "linuxdeploy/core/log.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace ldcache {
+            namespace {
+                // the structures and constants below are taken from glibc's sysdeps/generic/dl-cache.h
+                // the cache file is always stored in the host's byte order
+                const std::string CACHE_MAGIC_OLD = "ld.so-1.7.0";
+                const std::string CACHE_MAGIC_NEW = "glibc-ld.so.cache1.1";
+
+                struct FileEntryOld {
+                    int32_t flags;
+                    uint32_t key;
+                    uint32_t value;
+                };
+
+                struct CacheFileOld {
+                    char magic[11];
+                    uint32_t nlibs;
+                };
+
+                struct FileEntryNew {
+                    int32_t flags;
+                    uint32_t key;
+                    uint32_t value;
+                    uint32_t osVersion;
+                    uint64_t hwcap;
+                };
+
+                struct CacheFileNew {
+                    char magic[17];
+                    char version[3];
+                    uint32_t nlibs;
+                    uint32_t stringsLength;
+                    uint8_t flags;
+                    uint8_t padding[3];
+                    uint32_t extensionOffset;
+                    uint32_t unused[3];
+                };
+
+                // library types
+                const int32_t FLAG_ELF = 0x0001;
+                const int32_t FLAG_ELF_LIBC6 = 0x0003;
+
+                // architecture specific requirements
+                const int32_t FLAG_REQUIRED_MASK = 0xff00;
+
+                // the new format is aligned to the requirements of its largest member
+                const size_t CACHE_NEW_ALIGNMENT = alignof(CacheFileNew) > alignof(FileEntryNew) ? alignof(CacheFileNew) : alignof(FileEntryNew);
+
+                // the architecture flags ldconfig stores for libraries of a given ELF class and machine
+                // some architectures have more than one ABI, therefore more than one value may be returned
+                std::vector<int32_t> getArchitectureFlags(uint8_t elfClass, uint16_t elfMachine) {
+                    const bool is64Bit = elfClass == ELFCLASS64;
+
+                    switch (elfMachine) {
+                        case EM_X86_64:
+                            return {is64Bit ? 0x0300 : 0x0800};
+                        case EM_AARCH64:
+                            return {0x0a00};
+                        case EM_ARM:
+                            return {0x0900, 0x0b00, 0x0000};
+                        case EM_PPC64:
+                            return {0x0500};
+                        case EM_S390:
+                            return {is64Bit ? 0x0400 : 0x0000};
+                        case EM_SPARCV9:
+                            return {0x0100};
+                        case EM_IA_64:
+                            return {0x0200};
+                        case EM_MIPS:
+                            if (is64Bit)
+                                return {0x0700, 0x0e00};
+                            return {0x0000, 0x0600, 0x0c00, 0x0d00};
+                        case EM_RISCV:
+                            return {0x1000, 0x0f00};
+                        default:
+                            // other 32-bit architectures don't need any flags
+                            if (!is64Bit)
+                                return {0x0000};
+                            return {};
+                    }
+                }
+
+                struct IndexKey {
+                    std::string soname;
+                    int32_t flags;
+                    uint64_t hwcap;
+
+                    bool operator==(const IndexKey& other) const {
+                        return flags == other.flags && hwcap == other.hwcap && soname == other.soname;
+                    }
+                };
+
+                struct IndexKeyHash {
+                    size_t operator()(const IndexKey& key) const {
+                        size_t seed = std::hash<std::string>()(key.soname);
+                        boost::hash_combine(seed, key.flags);
+                        boost::hash_combine(seed, key.hwcap);
+                        return seed;
+                    }
+                };
+            }
+
+            class LdCache::PrivateData {
+                public:
+                    // maps soname, flags and hwcap to the library's path
+                    std::unordered_map<IndexKey, std::string, IndexKeyHash> index;
+
+                public:
+                    PrivateData() : index() {};
+
+                private:
+                    static bool readString(const std::vector<char>& data, uint64_t offset, std::string& out) {
+                        if (offset >= data.size())
+                            return false;
+
+                        const auto* begin = data.data() + offset;
+                        const auto* end = static_cast<const char*>(memchr(begin, '\0', data.size() - offset));
+
+                        if (end == nullptr)
+                            return false;
+
+                        out.assign(begin, end);
+                        return true;
+                    }
+
+                    void addEntry(const std::vector<char>& data, uint64_t stringsBase, int32_t flags, uint32_t key, uint32_t value, uint64_t hwcap) {
+                        std::string soname, path;
+
+                        if (!readString(data, stringsBase + key, soname) || !readString(data, stringsBase + value, path))
+                            throw LdCacheParseError("Invalid string offset in cache entry");
+
+                        IndexKey indexKey = {soname, flags & 0xffff, hwcap};
+
+                        // like the dynamic linker, the first matching entry wins
+                        index.insert(std::make_pair(indexKey, path));
+                    }
+
+                public:
+                    void parseNewFormat(const std::vector<char>& data, uint64_t offset) {
+                        CacheFileNew header{};
+
+                        if (data.size() < offset || data.size() - offset < sizeof(header))
+                            throw LdCacheParseError("Truncated cache header");
+
+                        memcpy(&header, data.data() + offset, sizeof(header));
+
+                        const uint64_t entriesOffset = offset + sizeof(header);
+
+                        if (header.nlibs > (data.size() - entriesOffset) / sizeof(FileEntryNew))
+                            throw LdCacheParseError("Truncated cache entries");
+
+                        for (uint32_t i = 0; i < header.nlibs; i++) {
+                            FileEntryNew entry{};
+                            memcpy(&entry, data.data() + entriesOffset + i * sizeof(entry), sizeof(entry));
+
+                            // in the new format, the string offsets are relative to the header
+                            addEntry(data, offset, entry.flags, entry.key, entry.value, entry.hwcap);
+                        }
+                    }
+
+                    void parseOldFormat(const std::vector<char>& data) {
+                        CacheFileOld header{};
+                        memcpy(&header, data.data(), sizeof(header));
+
+                        const uint64_t entriesOffset = sizeof(header);
+
+                        if (header.nlibs > (data.size() - entriesOffset) / sizeof(FileEntryOld))
+                            throw LdCacheParseError("Truncated cache entries");
+
+                        const uint64_t stringsOffset = entriesOffset + header.nlibs * sizeof(FileEntryOld);
+
+                        // the old format may be followed by a cache in the new format, which provides more information
+                        // (for instance, the hwcaps) and is therefore preferred
+                        const uint64_t newFormatOffset = (stringsOffset + CACHE_NEW_ALIGNMENT - 1) & ~(CACHE_NEW_ALIGNMENT - 1);
+
+                        if (newFormatOffset + CACHE_MAGIC_NEW.size() <= data.size() &&
+                            CACHE_MAGIC_NEW.compare(0, CACHE_MAGIC_NEW.size(), data.data() + newFormatOffset, CACHE_MAGIC_NEW.size()) == 0) {
+                            parseNewFormat(data, newFormatOffset);
+                            return;
+                        }
+
+                        for (uint32_t i = 0; i < header.nlibs; i++) {
+                            FileEntryOld entry{};
+                            memcpy(&entry, data.data() + entriesOffset + i * sizeof(entry), sizeof(entry));
+
+                            // in the old format, the string offsets are relative to the end of the entries
+                            addEntry(data, stringsOffset, entry.flags, entry.key, entry.value, 0);
+                        }
+                    }
+            };
+
+            LdCache::LdCache(const bf::path& path) {
+                std::ifstream ifs(path.string(), std::ios::binary);
+
+                if (!ifs)
+                    throw LdCacheParseError("Could not open cache file: " + path.string());
+
+                std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+                d = new PrivateData();
+
+                try {
+                    if (data.size() >= sizeof(CacheFileOld) &&
+                        CACHE_MAGIC_OLD.compare(0, CACHE_MAGIC_OLD.size(), data.data(), CACHE_MAGIC_OLD.size()) == 0) {
+                        d->parseOldFormat(data);
+                    } else if (data.size() >= sizeof(CacheFileNew) &&
+                        CACHE_MAGIC_NEW.compare(0, CACHE_MAGIC_NEW.size(), data.data(), CACHE_MAGIC_NEW.size()) == 0) {
+                        d->parseNewFormat(data, 0);
+                    } else {
+                        throw LdCacheParseError("Invalid magic bytes in cache file: " + path.string());
+                    }
+                } catch (...) {
+                    delete d;
+                    throw;
+                }
+
+                ldLog() << LD_DEBUG << "Loaded" << d->index.size() << "entries from dynamic linker cache" << path << std::endl;
+            }
+
+            LdCache::~LdCache() {
+                delete d;
+            }
+
+            bf::path LdCache::lookup(const std::string& soname, const uint8_t elfClass, const uint16_t elfMachine, const uint64_t hwcap) const {
+                auto find = [this, &soname, hwcap](int32_t flags) -> bf::path {
+                    IndexKey key = {soname, flags, hwcap};
+
+                    auto it = d->index.find(key);
+
+                    if (it == d->index.end())
+                        return "";
+
+                    return it->second;
+                };
+
+                for (const auto architectureFlags : getArchitectureFlags(elfClass, elfMachine)) {
+                    auto result = find((architectureFlags & FLAG_REQUIRED_MASK) | FLAG_ELF_LIBC6);
+
+                    if (!result.empty())
+                        return result;
+                }
+
+                // the dynamic linker also accepts entries with the generic ELF type, which don't carry any
+                // architecture information
+                return find(FLAG_ELF);
+            }
+
+            size_t LdCache::size() const {
+                return d->index.size();
+            }
+        }
+    }
+}
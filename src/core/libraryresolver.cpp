@@ -0,0 +1,335 @@
+// system headers
+#include <cstdlib>
+#include <elf.h>
+#include <fstream>
+#include <glob.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sys/utsname.h>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/elf.h"
+#include "linuxdeploy/core/ldcache.h"
+#include "linuxdeploy/core/libraryresolver.h"
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/util/util.h"
+
+using namespace linuxdeploy::core;
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace libraryresolver {
+            class LibraryResolver::PrivateData {
+                public:
+                    // directories from $LD_LIBRARY_PATH
+                    std::vector<std::string> ldLibraryPathDirectories;
+
+                    // directories configured in /etc/ld.so.conf and the files it includes
+                    // only used if the dynamic linker cache is not available
+                    std::vector<std::string> ldSoConfDirectories;
+
+                    // index of the dynamic linker cache, built once per run
+                    std::unique_ptr<ldcache::LdCache> ldCache;
+
+                    // caches the result of checks whether a file is a library matching a specific class and machine
+                    // libraries are searched from multiple threads, therefore the cache is protected by a mutex
+                    std::map<std::string, std::pair<uint8_t, uint16_t>> checkedFiles;
+                    std::mutex checkedFilesMutex;
+
+                public:
+                    PrivateData() : ldLibraryPathDirectories(), ldSoConfDirectories(), ldCache(), checkedFiles(), checkedFilesMutex() {
+                        const auto* ldLibraryPath = getenv("LD_LIBRARY_PATH");
+
+                        if (ldLibraryPath != nullptr) {
+                            // the dynamic linker accepts both colons and semicolons as separators
+                            std::string value = ldLibraryPath;
+                            std::replace(value.begin(), value.end(), ';', ':');
+
+                            for (const auto& directory : util::split(value, ':')) {
+                                // $ORIGIN etc. would have to be expanded relative to the main executable, which isn't
+                                // known here
+                                if (util::stringContains(directory, "$")) {
+                                    ldLog() << LD_WARNING << "Ignoring $LD_LIBRARY_PATH entry containing dynamic string token:" << directory << std::endl;
+                                    continue;
+                                }
+
+                                // empty entries refer to the current working directory
+                                ldLibraryPathDirectories.push_back(directory.empty() ? "." : directory);
+                            }
+                        }
+
+                        // the cache contains all the libraries in the directories configured in ld.so.conf
+                        // the configuration needs to be parsed only if the cache can't be used
+                        try {
+                            ldCache.reset(new ldcache::LdCache());
+                        } catch (const ldcache::LdCacheParseError& e) {
+                            ldLog() << LD_WARNING << "Could not read dynamic linker cache, falling back to directories in ld.so.conf:" << e.what() << std::endl;
+
+                            std::set<std::string> visitedConfigFiles;
+                            parseLdSoConf("/etc/ld.so.conf", visitedConfigFiles);
+                        }
+                    }
+
+                public:
+                    // parse ld.so.conf style configuration file, following include statements
+                    void parseLdSoConf(const bf::path& path, std::set<std::string>& visitedConfigFiles) {
+                        // protect against include loops
+                        if (!visitedConfigFiles.insert(path.string()).second)
+                            return;
+
+                        std::ifstream ifs(path.string());
+
+                        if (!ifs) {
+                            ldLog() << LD_DEBUG << "Could not open dynamic linker configuration file:" << path << std::endl;
+                            return;
+                        }
+
+                        std::string line;
+                        while (std::getline(ifs, line)) {
+                            // strip comments
+                            auto commentPos = line.find('#');
+                            if (commentPos != std::string::npos)
+                                line.erase(commentPos);
+
+                            util::trim(line);
+                            util::trim(line, '\t');
+
+                            if (line.empty())
+                                continue;
+
+                            if (util::stringStartsWith(line, "include") && line.size() > 7 && (line[7] == ' ' || line[7] == '\t')) {
+                                auto pattern = line.substr(8);
+                                util::trim(pattern);
+                                util::trim(pattern, '\t');
+
+                                // relative patterns are relative to the directory containing the current file
+                                if (!pattern.empty() && pattern[0] != '/')
+                                    pattern = (path.parent_path() / pattern).string();
+
+                                glob_t globResult;
+
+                                if (glob(pattern.c_str(), 0, nullptr, &globResult) == 0) {
+                                    for (size_t i = 0; i < globResult.gl_pathc; i++)
+                                        parseLdSoConf(globResult.gl_pathv[i], visitedConfigFiles);
+                                }
+
+                                globfree(&globResult);
+                                continue;
+                            }
+
+                            // hwcap entries are not relevant for us
+                            if (util::stringStartsWith(line, "hwcap") && line.size() > 5 && (line[5] == ' ' || line[5] == '\t'))
+                                continue;
+
+                            // old style entries may contain a library type, e.g., /usr/lib=libc6
+                            auto equalsPos = line.find('=');
+                            if (equalsPos != std::string::npos)
+                                line.erase(equalsPos);
+
+                            // entries may also be separated by commas or whitespace
+                            for (auto& c : line) {
+                                if (c == ',' || c == '\t')
+                                    c = ' ';
+                            }
+
+                            for (const auto& directory : util::split(line, ' ')) {
+                                if (directory.empty())
+                                    continue;
+
+                                if (std::find(ldSoConfDirectories.begin(), ldSoConfDirectories.end(), directory) == ldSoConfDirectories.end())
+                                    ldSoConfDirectories.push_back(directory);
+                            }
+                        }
+                    }
+
+                    // the dynamic linker's built-in search directories, searched after all other directories
+                    static std::vector<std::string> getDefaultDirectories(uint8_t elfClass) {
+                        if (elfClass == ELFCLASS64)
+                            return {"/lib64", "/usr/lib64", "/lib", "/usr/lib"};
+
+                        return {"/lib32", "/usr/lib32", "/lib", "/usr/lib"};
+                    }
+
+                    // check whether a file is a shared library matching the given class and machine
+                    // the dynamic linker skips incompatible files, e.g., 32-bit libraries in a 64-bit search directory
+                    bool isCompatibleLibrary(const bf::path& path, uint8_t elfClass, uint16_t elfMachine) {
+                        {
+                            std::lock_guard<std::mutex> lock(checkedFilesMutex);
+                            auto it = checkedFiles.find(path.string());
+
+                            if (it != checkedFiles.end())
+                                return it->second.first == elfClass && it->second.second == elfMachine;
+                        }
+
+                        // the file is checked without holding the lock; if another thread checks the same file at the
+                        // same time, both come to the same result
+                        // (0, 0) marks files that are not ELF files, or don't exist
+                        std::pair<uint8_t, uint16_t> fileInfo(0, 0);
+
+                        boost::system::error_code ec;
+                        if (bf::is_regular_file(path, ec)) {
+                            try {
+                                elf::ElfFile file(path);
+                                fileInfo = std::make_pair(file.getElfClass(), file.getElfMachine());
+                            } catch (const elf::ElfFileParseError& e) {
+                                ldLog() << LD_DEBUG << "Skipping invalid library candidate" << path << LD_NO_SPACE << ":" << e.what() << std::endl;
+                            }
+                        }
+
+                        {
+                            std::lock_guard<std::mutex> lock(checkedFilesMutex);
+                            checkedFiles.insert(std::make_pair(path.string(), fileInfo));
+                        }
+
+                        return fileInfo.first == elfClass && fileInfo.second == elfMachine;
+                    }
+
+                    bf::path searchDirectories(const std::vector<std::string>& directories, const std::string& name, const SearchContext& context) {
+                        for (const auto& directory : directories) {
+                            auto candidate = bf::path(directory) / name;
+
+                            if (isCompatibleLibrary(candidate, context.elfClass, context.elfMachine))
+                                return candidate;
+                        }
+
+                        return "";
+                    }
+            };
+
+            LibraryResolver::LibraryResolver() {
+                d = new PrivateData();
+            }
+
+            LibraryResolver::~LibraryResolver() {
+                delete d;
+            }
+
+            LibraryResolver& LibraryResolver::getInstance() {
+                static LibraryResolver instance;
+                return instance;
+            }
+
+            bf::path LibraryResolver::findLibrary(const std::string& name, const SearchContext& context) {
+                // names containing a slash are treated as paths, no search is performed
+                if (util::stringContains(name, "/")) {
+                    if (d->isCompatibleLibrary(name, context.elfClass, context.elfMachine))
+                        return bf::absolute(name);
+
+                    return "";
+                }
+
+                // search order as documented in ld.so(8)
+                bf::path result;
+
+                if (!context.hasRunPath)
+                    result = d->searchDirectories(context.rpathDirectories, name, context);
+
+                if (result.empty())
+                    result = d->searchDirectories(d->ldLibraryPathDirectories, name, context);
+
+                if (result.empty() && context.hasRunPath)
+                    result = d->searchDirectories(context.runpathDirectories, name, context);
+
+                if (result.empty()) {
+                    if (d->ldCache != nullptr) {
+                        auto cachedPath = d->ldCache->lookup(name, context.elfClass, context.elfMachine);
+
+                        // the cache might be outdated, the file needs to be checked anyway
+                        if (!cachedPath.empty() && d->isCompatibleLibrary(cachedPath, context.elfClass, context.elfMachine))
+                            result = cachedPath;
+                    } else {
+                        result = d->searchDirectories(d->ldSoConfDirectories, name, context);
+                    }
+                }
+
+                if (result.empty())
+                    result = d->searchDirectories(d->getDefaultDirectories(context.elfClass), name, context);
+
+                if (!result.empty())
+                    result = bf::absolute(result);
+
+                return result;
+            }
+
+            std::vector<std::string> LibraryResolver::expandSearchPath(const std::string& searchPath, const bf::path& origin, const uint8_t elfClass) {
+                std::vector<std::string> directories;
+
+                // initialized once, in a thread safe way, as the dependencies are resolved by multiple threads
+                static const std::string platform = [] {
+                    struct utsname unameData{};
+                    return uname(&unameData) == 0 ? std::string(unameData.machine) : std::string();
+                }();
+
+                const std::vector<std::pair<std::string, std::string>> tokens = {
+                    {"ORIGIN", origin.string()},
+                    {"LIB", elfClass == ELFCLASS64 ? "lib64" : "lib"},
+                    {"PLATFORM", platform},
+                };
+
+                for (const auto& entry : util::split(searchPath, ':')) {
+                    std::string expanded;
+                    bool valid = true;
+
+                    for (size_t i = 0; i < entry.size() && valid; i++) {
+                        if (entry[i] != '$') {
+                            expanded += entry[i];
+                            continue;
+                        }
+
+                        bool tokenFound = false;
+
+                        for (const auto& token : tokens) {
+                            const auto& tokenName = token.first;
+
+                            // both $TOKEN and ${TOKEN} are allowed
+                            size_t tokenLength = 0;
+
+                            if (entry.compare(i + 1, tokenName.size() + 2, "{" + tokenName + "}") == 0) {
+                                tokenLength = tokenName.size() + 2;
+                            } else if (entry.compare(i + 1, tokenName.size(), tokenName) == 0) {
+                                // make sure the token is not just a prefix of a longer name
+                                auto next = i + 1 + tokenName.size();
+                                if (next < entry.size() && (isalnum(static_cast<unsigned char>(entry[next])) || entry[next] == '_'))
+                                    continue;
+
+                                tokenLength = tokenName.size();
+                            }
+
+                            if (tokenLength > 0) {
+                                // a token which expands to an empty string is treated like an unknown token
+                                if (token.second.empty())
+                                    break;
+
+                                expanded += token.second;
+                                i += tokenLength;
+                                tokenFound = true;
+                                break;
+                            }
+                        }
+
+                        if (!tokenFound)
+                            valid = false;
+                    }
+
+                    if (!valid) {
+                        ldLog() << LD_DEBUG << "Ignoring search path entry with unsupported dynamic string token:" << entry << std::endl;
+                        continue;
+                    }
+
+                    // empty entries refer to the current working directory
+                    directories.push_back(expanded.empty() ? "." : expanded);
+                }
+
+                return directories;
+            }
+        }
+    }
+}
@@ -6,6 +6,8 @@ namespace linuxdeploy {
         namespace log {
             LD_LOGLEVEL ldLog::verbosity = LD_INFO;
 
+            std::mutex ldLog::mutex;
+
             void ldLog::setVerbosity(LD_LOGLEVEL verbosity) {
                 ldLog::verbosity = verbosity;
             }
@@ -14,17 +16,34 @@ namespace linuxdeploy {
                 prependSpace = false;
                 currentLogLevel = LD_INFO;
                 logLevelSet = false;
+                buffer = BufferType(new std::ostringstream(), [](std::ostringstream* buffer) {
+                    writeBuffer(*buffer);
+                    delete buffer;
+                });
             };
 
-            ldLog::ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel) {
+            ldLog::ldLog(bool prependSpace, bool logLevelSet, LD_LOGLEVEL logLevel, BufferType buffer) {
                 this->prependSpace = prependSpace;
                 this->currentLogLevel = logLevel;
                 this->logLevelSet = logLevelSet;
+                this->buffer = std::move(buffer);
+            }
+
+            void ldLog::writeBuffer(std::ostringstream& buffer) {
+                const auto text = buffer.str();
+
+                if (text.empty())
+                    return;
+
+                buffer.str("");
+
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cout << text << std::flush;
             }
 
             void ldLog::checkPrependSpace() {
                 if (prependSpace) {
-                    stream << " ";
+                    *buffer << " ";
                     prependSpace = false;
                 }
             }
@@ -37,27 +56,27 @@ namespace linuxdeploy {
             ldLog ldLog::operator<<(const std::string& message) {
                 if (checkVerbosity()) {
                     checkPrependSpace();
-                    stream << message;
+                    *buffer << message;
                 }
 
-                return ldLog(true, logLevelSet, currentLogLevel);
+                return ldLog(true, logLevelSet, currentLogLevel, buffer);
             }
             ldLog ldLog::operator<<(const char* message) {
                 if (checkVerbosity()) {
                     checkPrependSpace();
-                    stream << message;
+                    *buffer << message;
                 }
 
-                return ldLog(true, logLevelSet, currentLogLevel);
+                return ldLog(true, logLevelSet, currentLogLevel, buffer);
             }
 
             ldLog ldLog::operator<<(const boost::filesystem::path& path) {
                 if (checkVerbosity()) {
                     checkPrependSpace();
-                    stream << path.string();
+                    *buffer << path.string();
                 }
 
-                return ldLog(true, logLevelSet, currentLogLevel);
+                return ldLog(true, logLevelSet, currentLogLevel, buffer);
             }
 
             ldLog ldLog::operator<<(const int val) {
@@ -72,13 +91,14 @@ namespace linuxdeploy {
                 return ldLog::operator<<(std::to_string(val));
             }
 
-            ldLog ldLog::operator<<(stdEndlType strm) {
+            ldLog ldLog::operator<<(stdEndlType) {
                 if (checkVerbosity()) {
                     checkPrependSpace();
-                    stream << strm;
+                    *buffer << '\n';
+                    writeBuffer(*buffer);
                 }
 
-                return ldLog(false, logLevelSet, currentLogLevel);
+                return ldLog(false, logLevelSet, currentLogLevel, buffer);
             }
 
             ldLog ldLog::operator<<(const LD_LOGLEVEL logLevel) {
@@ -93,20 +113,20 @@ namespace linuxdeploy {
                 if (checkVerbosity()) {
                     switch (logLevel) {
                         case LD_DEBUG:
-                            stream << "DEBUG: ";
+                            *buffer << "DEBUG: ";
                             break;
                         case LD_WARNING:
-                            stream << "WARNING: ";
+                            *buffer << "WARNING: ";
                             break;
                         case LD_ERROR:
-                            stream << "ERROR: ";
+                            *buffer << "ERROR: ";
                             break;
                         default:
                             break;
                     }
                 }
 
-                return ldLog(false, logLevelSet, currentLogLevel);
+                return ldLog(false, logLevelSet, currentLogLevel, buffer);
             }
 
             ldLog ldLog::operator<<(const LD_STREAM_CONTROL streamControl) {
@@ -120,7 +140,7 @@ namespace linuxdeploy {
                         break;
                 }
 
-                return ldLog(prependSpace, logLevelSet, currentLogLevel);
+                return ldLog(prependSpace, logLevelSet, currentLogLevel, buffer);
             }
         }
     }
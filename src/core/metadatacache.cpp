@@ -0,0 +1,462 @@
+// system headers
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/metadatacache.h"
+#include "linuxdeploy/core/storage.h"
+
+using namespace linuxdeploy::core::log;
+using namespace linuxdeploy::core::storage;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace metadatacache {
+            namespace {
+                // must be increased whenever the format of the entries or the meaning of the values changes
+                const std::string CACHE_MAGIC = "linuxdeploy-metadata-cache 2";
+
+                // the values are stored one per line, therefore they must not contain line breaks
+                bool isStorable(const std::string& value) {
+                    return isSingleLine(value);
+                }
+            }
+
+            class MetadataCache::PrivateData {
+                public:
+                    struct DependencyRecord {
+                        std::vector<bf::path> dependencies;
+                        std::vector<std::string> rpathDirectories;
+                    };
+
+                    struct Entry {
+                        // identifies path, identity of the file and configuration the entry belongs to
+                        // empty if the file cannot be cached
+                        std::string key;
+
+                        // whether the entry has been modified and needs to be written to disk
+                        bool dirty;
+
+                        bool hasStripped;
+                        bool stripped;
+
+                        bool hasCopyrightFiles;
+                        std::vector<bf::path> copyrightFiles;
+
+                        // the dependencies depend on the inherited DT_RPATH directories, too
+                        std::map<std::string, DependencyRecord> dependencies;
+
+                        Entry() : key(), dirty(false), hasStripped(false), stripped(false),
+                                  hasCopyrightFiles(false), copyrightFiles(), dependencies() {};
+                    };
+
+                public:
+                    bf::path directory;
+
+                    // describes the configuration of the dynamic linker, and everything else the cached values depend
+                    // on
+                    std::string configuration;
+
+                    std::mutex mutex;
+                    std::map<std::string, Entry> entries;
+
+                    size_t hits;
+                    size_t misses;
+
+                public:
+                    PrivateData(const bf::path& directory, const bf::path& packageDatabaseDirectory) : directory(directory), configuration(),
+                                                                                                       mutex(), entries(), hits(0), misses(0) {
+                        std::ostringstream oss;
+
+                        // the files ldconfig generates and reads
+                        for (const auto& path : {"/etc/ld.so.cache", "/etc/ld.so.conf", "/etc/ld.so.conf.d"})
+                            oss << path << "=" << describeFile(path) << ";";
+
+                        // the parts of the dpkg database the copyright files are looked up in, the info directory changes
+                        // whenever packages are installed or removed
+                        for (const auto& path : {packageDatabaseDirectory / "status", packageDatabaseDirectory / "info"})
+                            oss << path.string() << "=" << describeFile(path) << ";";
+
+                        const auto* ldLibraryPath = getenv("LD_LIBRARY_PATH");
+                        oss << "LD_LIBRARY_PATH=" << (ldLibraryPath == nullptr ? "" : ldLibraryPath);
+
+                        configuration = oss.str();
+                    }
+
+                public:
+                    static std::string getContext(const std::vector<std::string>& loaderRPathDirectories) {
+                        std::string context;
+
+                        for (const auto& directory : loaderRPathDirectories) {
+                            if (!context.empty())
+                                context += ":";
+
+                            context += directory;
+                        }
+
+                        return context;
+                    }
+
+                    bf::path getEntryPath(const std::string& key) const {
+                        return directory / "files" / toHex(fnv1a(key));
+                    }
+
+                    // look up entry for file, reading it from the cache directory if necessary
+                    // the mutex must be locked by the caller
+                    Entry& getEntry(const bf::path& path) {
+                        auto it = entries.find(path.string());
+
+                        if (it != entries.end())
+                            return it->second;
+
+                        Entry& entry = entries[path.string()];
+
+                        const auto identity = describeFile(path);
+
+                        if (identity.empty() || !isStorable(path.string()))
+                            return entry;
+
+                        entry.key = path.string() + "\n" + identity + "\n" + configuration;
+
+                        readEntry(entry);
+
+                        return entry;
+                    }
+
+                    // read entry from the cache directory
+                    // invalid or outdated entries are ignored
+                    void readEntry(Entry& entry) {
+                        std::ifstream ifs(getEntryPath(entry.key).string());
+
+                        if (!ifs)
+                            return;
+
+                        Entry result;
+                        result.key = entry.key;
+
+                        std::string line;
+
+                        if (!std::getline(ifs, line) || line != CACHE_MAGIC)
+                            return;
+
+                        // the key spans several lines
+                        std::string key;
+                        for (size_t i = 0; i < 3; i++) {
+                            if (!std::getline(ifs, line))
+                                return;
+
+                            key += (i > 0 ? "\n" : "") + line;
+                        }
+
+                        // hash collision, or the file has been modified
+                        if (key != entry.key)
+                            return;
+
+                        auto readLines = [&ifs](size_t count, std::vector<std::string>& out) {
+                            std::string value;
+
+                            for (size_t i = 0; i < count; i++) {
+                                if (!std::getline(ifs, value))
+                                    return false;
+
+                                out.push_back(value);
+                            }
+
+                            return true;
+                        };
+
+                        while (std::getline(ifs, line)) {
+                            std::istringstream iss(line);
+
+                            std::string type;
+                            iss >> type;
+
+                            if (type == "stripped") {
+                                int value = 0;
+
+                                if (!(iss >> value))
+                                    return;
+
+                                result.hasStripped = true;
+                                result.stripped = value != 0;
+                            } else if (type == "copyright") {
+                                size_t count = 0;
+                                std::vector<std::string> values;
+
+                                if (!(iss >> count) || !readLines(count, values))
+                                    return;
+
+                                result.hasCopyrightFiles = true;
+                                result.copyrightFiles.assign(values.begin(), values.end());
+                            } else if (type == "dependencies") {
+                                size_t dependencyCount = 0, directoryCount = 0;
+
+                                if (!(iss >> dependencyCount >> directoryCount))
+                                    return;
+
+                                std::string context;
+                                std::getline(iss >> std::ws, context);
+
+                                std::vector<std::string> dependencies;
+
+                                DependencyRecord record;
+
+                                if (!readLines(dependencyCount, dependencies) || !readLines(directoryCount, record.rpathDirectories))
+                                    return;
+
+                                record.dependencies.assign(dependencies.begin(), dependencies.end());
+                                result.dependencies[context] = record;
+                            } else {
+                                return;
+                            }
+                        }
+
+                        entry = result;
+                    }
+
+                    // write entry to the cache directory
+                    // the file is replaced atomically, therefore concurrent readers will never see partial entries
+                    bool writeEntry(const Entry& entry) {
+                        const auto entryPath = getEntryPath(entry.key);
+
+                        boost::system::error_code ec;
+                        bf::create_directories(entryPath.parent_path(), ec);
+
+                        if (ec) {
+                            ldLog() << LD_WARNING << "Could not create cache directory" << entryPath.parent_path() << LD_NO_SPACE << ":" << ec.message() << std::endl;
+                            return false;
+                        }
+
+                        std::ostringstream oss;
+                        oss << CACHE_MAGIC << "\n" << entry.key << "\n";
+
+                        if (entry.hasStripped)
+                            oss << "stripped " << entry.stripped << "\n";
+
+                        if (entry.hasCopyrightFiles) {
+                            oss << "copyright " << entry.copyrightFiles.size() << "\n";
+
+                            for (const auto& copyrightFile : entry.copyrightFiles)
+                                oss << copyrightFile.string() << "\n";
+                        }
+
+                        for (const auto& pair : entry.dependencies) {
+                            const auto& record = pair.second;
+
+                            oss << "dependencies " << record.dependencies.size() << " " << record.rpathDirectories.size()
+                                << " " << pair.first << "\n";
+
+                            for (const auto& dependency : record.dependencies)
+                                oss << dependency.string() << "\n";
+
+                            for (const auto& directory : record.rpathDirectories)
+                                oss << directory << "\n";
+                        }
+
+                        if (!writeFileAtomically(entryPath, oss.str())) {
+                            ldLog() << LD_WARNING << "Could not write cache entry" << entryPath << std::endl;
+                            return false;
+                        }
+
+                        return true;
+                    }
+
+                    // count lookup, and pass through its result
+                    bool countLookup(bool hit) {
+                        if (hit)
+                            hits++;
+                        else
+                            misses++;
+
+                        return hit;
+                    }
+            };
+
+            MetadataCache::MetadataCache(const bf::path& directory, const bf::path& packageDatabaseDirectory) {
+                d = new PrivateData(directory, packageDatabaseDirectory);
+            }
+
+            MetadataCache::~MetadataCache() {
+                delete d;
+            }
+
+            bf::path MetadataCache::getDefaultDirectory() {
+                const auto* xdgCacheHome = getenv("XDG_CACHE_HOME");
+
+                // relative paths are invalid according to the XDG base directory specification
+                if (xdgCacheHome != nullptr && xdgCacheHome[0] == '/')
+                    return bf::path(xdgCacheHome) / "linuxdeploy";
+
+                const auto* home = getenv("HOME");
+
+                if (home != nullptr && home[0] != '\0')
+                    return bf::path(home) / ".cache" / "linuxdeploy";
+
+                return "";
+            }
+
+            bf::path MetadataCache::directory() const {
+                return d->directory;
+            }
+
+            bool MetadataCache::getDependencies(const bf::path& path, const std::vector<std::string>& loaderRPathDirectories,
+                                                std::vector<bf::path>& dependencies, std::vector<std::string>& rpathDirectories) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto& entry = d->getEntry(path);
+
+                auto it = entry.dependencies.find(d->getContext(loaderRPathDirectories));
+
+                if (it == entry.dependencies.end())
+                    return d->countLookup(false);
+
+                // libraries might have been removed from directories which are not covered by the configuration, e.g.,
+                // directories in the rpath
+                for (const auto& dependency : it->second.dependencies) {
+                    if (describeFile(dependency).empty())
+                        return d->countLookup(false);
+                }
+
+                dependencies = it->second.dependencies;
+                rpathDirectories = it->second.rpathDirectories;
+
+                return d->countLookup(true);
+            }
+
+            void MetadataCache::setDependencies(const bf::path& path, const std::vector<std::string>& loaderRPathDirectories,
+                                                const std::vector<bf::path>& dependencies, const std::vector<std::string>& rpathDirectories) {
+                const auto context = PrivateData::getContext(loaderRPathDirectories);
+
+                if (!isStorable(context))
+                    return;
+
+                for (const auto& dependency : dependencies) {
+                    if (!isStorable(dependency.string()))
+                        return;
+                }
+
+                for (const auto& directory : rpathDirectories) {
+                    if (!isStorable(directory))
+                        return;
+                }
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto& entry = d->getEntry(path);
+
+                if (entry.key.empty())
+                    return;
+
+                auto& record = entry.dependencies[context];
+                record.dependencies = dependencies;
+                record.rpathDirectories = rpathDirectories;
+                entry.dirty = true;
+            }
+
+            bool MetadataCache::getStripped(const bf::path& path, bool& stripped) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto& entry = d->getEntry(path);
+
+                if (!entry.hasStripped)
+                    return d->countLookup(false);
+
+                stripped = entry.stripped;
+                return d->countLookup(true);
+            }
+
+            void MetadataCache::setStripped(const bf::path& path, bool stripped) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto& entry = d->getEntry(path);
+
+                if (entry.key.empty())
+                    return;
+
+                entry.hasStripped = true;
+                entry.stripped = stripped;
+                entry.dirty = true;
+            }
+
+            bool MetadataCache::getCopyrightFiles(const bf::path& path, std::vector<bf::path>& copyrightFiles) {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                const auto& entry = d->getEntry(path);
+
+                if (!entry.hasCopyrightFiles)
+                    return d->countLookup(false);
+
+                for (const auto& copyrightFile : entry.copyrightFiles) {
+                    if (describeFile(copyrightFile).empty())
+                        return d->countLookup(false);
+                }
+
+                copyrightFiles = entry.copyrightFiles;
+                return d->countLookup(true);
+            }
+
+            void MetadataCache::setCopyrightFiles(const bf::path& path, const std::vector<bf::path>& copyrightFiles) {
+                for (const auto& copyrightFile : copyrightFiles) {
+                    if (!isStorable(copyrightFile.string()))
+                        return;
+                }
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                auto& entry = d->getEntry(path);
+
+                if (entry.key.empty())
+                    return;
+
+                entry.hasCopyrightFiles = true;
+                entry.copyrightFiles = copyrightFiles;
+                entry.dirty = true;
+            }
+
+            bool MetadataCache::save() {
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                bool success = true;
+                size_t written = 0;
+
+                for (auto& pair : d->entries) {
+                    auto& entry = pair.second;
+
+                    if (!entry.dirty)
+                        continue;
+
+                    if (!d->writeEntry(entry)) {
+                        success = false;
+                        continue;
+                    }
+
+                    entry.dirty = false;
+                    written++;
+                }
+
+                ldLog() << LD_DEBUG << "Wrote" << written << "entries to metadata cache" << d->directory << std::endl;
+
+                return success;
+            }
+
+            size_t MetadataCache::hits() const {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                return d->hits;
+            }
+
+            size_t MetadataCache::misses() const {
+                std::lock_guard<std::mutex> lock(d->mutex);
+                return d->misses;
+            }
+        }
+    }
+}
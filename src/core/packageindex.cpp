@@ -0,0 +1,165 @@
+// system headers
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/packageindex.h"
+#include "linuxdeploy/core/pathtable.h"
+
+using namespace linuxdeploy::core::log;
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace packageindex {
+            class PackageIndex::PrivateData {
+                public:
+                    bf::path adminDirectory;
+
+                    std::mutex mutex;
+                    bool built;
+
+                    // paths of all the files listed in the database
+                    pathtable::StringTable paths;
+
+                    // index of the package owning the file, indexed by the paths' IDs
+                    std::vector<uint32_t> owners;
+
+                    std::vector<std::string> packageNames;
+
+                public:
+                    explicit PrivateData(const bf::path& adminDirectory) : adminDirectory(adminDirectory), mutex(), built(false),
+                                                                           paths(), owners(), packageNames() {};
+
+                public:
+                    // the file lists are named <package>.list or <package>:<architecture>.list
+                    static std::string packageNameFromListFile(const bf::path& listFile) {
+                        auto name = listFile.stem().string();
+
+                        const auto colon = name.find(':');
+
+                        if (colon != std::string::npos)
+                            name.erase(colon);
+
+                        return name;
+                    }
+
+                    void addListFile(const bf::path& listFile) {
+                        std::ifstream ifs(listFile.string(), std::ios::binary);
+
+                        if (!ifs) {
+                            ldLog() << LD_WARNING << "Could not read dpkg file list:" << listFile << std::endl;
+                            return;
+                        }
+
+                        const std::string contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+                        const auto packageIndex = static_cast<uint32_t>(packageNames.size());
+                        packageNames.push_back(packageNameFromListFile(listFile));
+
+                        size_t lineStart = 0;
+
+                        while (lineStart < contents.size()) {
+                            auto lineEnd = contents.find('\n', lineStart);
+
+                            if (lineEnd == std::string::npos)
+                                lineEnd = contents.size();
+
+                            if (lineEnd > lineStart) {
+                                const auto id = paths.intern(contents.substr(lineStart, lineEnd - lineStart));
+
+                                // the IDs are assigned densely, a new ID means the path hasn't been listed before
+                                if (id == owners.size())
+                                    owners.push_back(packageIndex);
+                            }
+
+                            lineStart = lineEnd + 1;
+                        }
+                    }
+
+                    void build() {
+                        std::lock_guard<std::mutex> lock(mutex);
+
+                        if (built)
+                            return;
+
+                        built = true;
+
+                        const auto infoDirectory = adminDirectory / "info";
+
+                        if (!bf::is_directory(infoDirectory))
+                            return;
+
+                        // the lists are read in a well-defined order, so that files which belong to multiple packages are
+                        // attributed to the same package in every run
+                        std::vector<bf::path> listFiles;
+
+                        for (bf::directory_iterator i(infoDirectory); i != bf::directory_iterator(); ++i) {
+                            if (i->path().extension() == ".list")
+                                listFiles.push_back(i->path());
+                        }
+
+                        std::sort(listFiles.begin(), listFiles.end());
+
+                        for (const auto& listFile : listFiles)
+                            addListFile(listFile);
+
+                        ldLog() << LD_DEBUG << "Indexed" << owners.size() << "paths of" << packageNames.size()
+                                << "packages in dpkg database" << adminDirectory << std::endl;
+                    }
+            };
+
+            PackageIndex::PackageIndex(const bf::path& adminDirectory) {
+                d = new PrivateData(adminDirectory);
+            }
+
+            PackageIndex::~PackageIndex() {
+                delete d;
+            }
+
+            bf::path PackageIndex::defaultAdminDirectory() {
+                const auto* adminDirectory = getenv("DPKG_ADMINDIR");
+
+                if (adminDirectory != nullptr && adminDirectory[0] != '\0')
+                    return adminDirectory;
+
+                return "/var/lib/dpkg";
+            }
+
+            bf::path PackageIndex::getAdminDirectory() const {
+                return d->adminDirectory;
+            }
+
+            bool PackageIndex::isAvailable() const {
+                return bf::is_directory(d->adminDirectory / "info");
+            }
+
+            bool PackageIndex::findPackage(const bf::path& path, std::string& packageName) {
+                d->build();
+
+                std::lock_guard<std::mutex> lock(d->mutex);
+
+                pathtable::StringId id;
+
+                if (!d->paths.find(bf::absolute(path).lexically_normal().string(), id))
+                    return false;
+
+                packageName = d->packageNames[d->owners[id]];
+                return true;
+            }
+
+            bf::path PackageIndex::getCopyrightFilePath(const std::string& packageName) {
+                return bf::path("/usr/share/doc") / packageName / "copyright";
+            }
+        }
+    }
+}
@@ -0,0 +1,161 @@
+// system headers
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+// library headers
+#include <boost/filesystem.hpp>
+
+// local headers
+#include "linuxdeploy/core/pathtable.h"
+#include "linuxdeploy/core/storage.h"
+
+namespace bf = boost::filesystem;
+
+namespace linuxdeploy {
+    namespace core {
+        namespace pathtable {
+            class StringTable::PrivateData {
+                public:
+                    // the strings are stored in blocks of this size, larger strings get a block of their own
+                    static const size_t BLOCK_SIZE = 64 * 1024;
+
+                    std::vector<std::unique_ptr<char[]>> blocks;
+
+                    // size and used space of the last block
+                    size_t blockCapacity;
+                    size_t blockUsed;
+
+                    struct StoredString {
+                        const char* data;
+                        size_t size;
+                        uint64_t hash;
+                    };
+
+                    // indexed by the IDs
+                    std::vector<StoredString> strings;
+
+                    // open addressing hash table of IDs + 1 (0 marks empty slots)
+                    // the size is always a power of two, and kept at most half full
+                    std::vector<StringId> slots;
+
+                public:
+                    PrivateData() : blocks(), blockCapacity(0), blockUsed(0), strings(), slots(64, 0) {};
+
+                public:
+                    // find the slot which contains the string, or the empty slot it would be stored in
+                    size_t findSlot(const char* data, size_t size, uint64_t hash) const {
+                        const auto mask = slots.size() - 1;
+
+                        for (auto slot = static_cast<size_t>(hash) & mask;; slot = (slot + 1) & mask) {
+                            const auto value = slots[slot];
+
+                            if (value == 0)
+                                return slot;
+
+                            const auto& stored = strings[value - 1];
+
+                            if (stored.hash == hash && stored.size == size && memcmp(stored.data, data, size) == 0)
+                                return slot;
+                        }
+                    }
+
+                    const char* store(const char* data, size_t size) {
+                        if (blocks.empty() || blockCapacity - blockUsed < size) {
+                            blockCapacity = std::max(size, BLOCK_SIZE);
+                            blockUsed = 0;
+                            blocks.emplace_back(new char[blockCapacity]);
+                        }
+
+                        auto* destination = blocks.back().get() + blockUsed;
+                        memcpy(destination, data, size);
+                        blockUsed += size;
+
+                        return destination;
+                    }
+
+                    void grow() {
+                        std::vector<StringId> newSlots(slots.size() * 2, 0);
+                        const auto mask = newSlots.size() - 1;
+
+                        for (StringId id = 0; id < strings.size(); id++) {
+                            auto slot = static_cast<size_t>(strings[id].hash) & mask;
+
+                            while (newSlots[slot] != 0)
+                                slot = (slot + 1) & mask;
+
+                            newSlots[slot] = id + 1;
+                        }
+
+                        slots.swap(newSlots);
+                    }
+            };
+
+            const size_t StringTable::PrivateData::BLOCK_SIZE;
+
+            StringTable::StringTable() {
+                d = new PrivateData();
+            }
+
+            StringTable::~StringTable() {
+                delete d;
+            }
+
+            StringId StringTable::intern(const std::string& value) {
+                const auto hash = storage::fnv1a(value);
+
+                auto slot = d->findSlot(value.data(), value.size(), hash);
+
+                if (d->slots[slot] != 0)
+                    return d->slots[slot] - 1;
+
+                const auto id = static_cast<StringId>(d->strings.size());
+                d->strings.push_back({d->store(value.data(), value.size()), value.size(), hash});
+
+                if (d->strings.size() * 2 > d->slots.size()) {
+                    d->grow();
+                } else {
+                    d->slots[slot] = id + 1;
+                }
+
+                return id;
+            }
+
+            bool StringTable::find(const std::string& value, StringId& id) const {
+                const auto hash = storage::fnv1a(value);
+                const auto slot = d->findSlot(value.data(), value.size(), hash);
+
+                if (d->slots[slot] == 0)
+                    return false;
+
+                id = d->slots[slot] - 1;
+                return true;
+            }
+
+            std::string StringTable::get(StringId id) const {
+                const auto& stored = d->strings[id];
+                return std::string(stored.data, stored.size);
+            }
+
+            size_t StringTable::size() const {
+                return d->strings.size();
+            }
+
+            std::string PathTable::normalize(const bf::path& path) {
+                std::string result;
+                result.reserve(path.string().size());
+
+                for (const auto& element : path) {
+                    const auto& value = element.string();
+
+                    if (!result.empty() && result.back() != '/' && value != "/")
+                        result += '/';
+
+                    result += value;
+                }
+
+                return result;
+            }
+        }
+    }
+}
@@ -0,0 +1,404 @@
+// system headers
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/patternmatcher.h"
+#include "linuxdeploy/core/storage.h"
+
+namespace linuxdeploy {
+    namespace core {
+        namespace patternmatcher {
+            namespace {
+                // single element of a pattern: either a *, or a set of characters matching exactly one character
+                struct PatternElement {
+                    bool star;
+                    std::bitset<256> characters;
+                };
+
+                // add the characters of a character class ([:alpha:] etc.) to a set
+                // returns false if the class is unknown
+                bool addCharacterClass(const std::string& name, std::bitset<256>& characters) {
+                    static const std::map<std::string, int (*)(int)> classes = {
+                        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+                        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+                        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+                    };
+
+                    const auto it = classes.find(name);
+
+                    if (it == classes.end())
+                        return false;
+
+                    for (int c = 0; c < 256; c++) {
+                        if (it->second(c))
+                            characters.set(static_cast<size_t>(c));
+                    }
+
+                    return true;
+                }
+
+                // parse bracket expression starting at pattern[start], which must be a [
+                // returns false if the expression is not terminated, in which case the [ is an ordinary character, and
+                // result is left unchanged
+                // like fnmatch(), patterns containing malformed collating symbols or equivalence classes ([.a.], [=a=])
+                // don't match anything, which is reported by setting valid to false
+                bool parseBracketExpression(const std::string& pattern, size_t start, std::bitset<256>& result, size_t& end, bool& valid) {
+                    size_t i = start + 1;
+
+                    const bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+                    if (negate)
+                        i++;
+
+                    std::bitset<256> characters;
+
+                    // a ] right after the opening bracket is an ordinary character
+                    for (bool first = true; i < pattern.size(); first = false) {
+                        auto c = static_cast<unsigned char>(pattern[i]);
+
+                        if (c == ']' && !first) {
+                            if (negate)
+                                characters.flip();
+
+                            result = characters;
+                            end = i + 1;
+                            return true;
+                        }
+
+                        if (c == '[' && i + 1 < pattern.size() && pattern[i + 1] == ':') {
+                            const auto classEnd = pattern.find(":]", i + 2);
+
+                            if (classEnd != std::string::npos && addCharacterClass(pattern.substr(i + 2, classEnd - i - 2), characters)) {
+                                i = classEnd + 2;
+                                continue;
+                            }
+                        }
+
+                        // only single characters are supported, which is what they are in the C locale
+                        if (c == '[' && i + 1 < pattern.size() && (pattern[i + 1] == '.' || pattern[i + 1] == '=')) {
+                            const char terminator[] = {pattern[i + 1], ']', '\0'};
+
+                            if (i + 4 >= pattern.size() || pattern.compare(i + 3, 2, terminator) != 0) {
+                                valid = false;
+                                return false;
+                            }
+
+                            c = static_cast<unsigned char>(pattern[i + 2]);
+                            i += 4;
+                        } else if (c == '\\' && i + 1 < pattern.size()) {
+                            c = static_cast<unsigned char>(pattern[++i]);
+                        }
+
+                        // ranges like a-z, a - at the end of the expression is an ordinary character
+                        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                            i += 2;
+
+                            if (pattern[i] == '\\' && i + 1 < pattern.size())
+                                i++;
+
+                            const auto last = static_cast<unsigned char>(pattern[i]);
+
+                            for (unsigned int character = c; character <= last; character++)
+                                characters.set(character);
+                        } else {
+                            characters.set(c);
+                        }
+
+                        i++;
+                    }
+
+                    return false;
+                }
+
+                // returns false if the pattern can't match anything
+                bool parsePattern(const std::string& pattern, std::vector<PatternElement>& elements) {
+                    bool valid = true;
+
+                    for (size_t i = 0; i < pattern.size();) {
+                        const auto c = static_cast<unsigned char>(pattern[i]);
+
+                        PatternElement element{false, {}};
+
+                        if (c == '*') {
+                            i++;
+
+                            // consecutive stars are equivalent to a single one
+                            if (!elements.empty() && elements.back().star)
+                                continue;
+
+                            element.star = true;
+                        } else if (c == '?') {
+                            element.characters.set();
+                            i++;
+                        } else if (c == '[' && parseBracketExpression(pattern, i, element.characters, i, valid)) {
+                            // nothing to do, the expression has been parsed already
+                        } else if (c == '\\' && i + 1 < pattern.size()) {
+                            element.characters.set(static_cast<unsigned char>(pattern[i + 1]));
+                            i += 2;
+                        } else {
+                            element.characters.set(c);
+                            i++;
+                        }
+
+                        // like with FNM_PATHNAME, a slash must be matched by a slash in the pattern
+                        if (!element.star && (c == '?' || c == '['))
+                            element.characters.reset('/');
+
+                        if (!valid)
+                            return false;
+
+                        elements.push_back(element);
+                    }
+
+                    return true;
+                }
+
+                // FNV-1a, salted with a seed so that a seed without collisions can be searched for
+                uint64_t hashName(const std::string& name, uint64_t seed) {
+                    const auto hash = storage::fnv1a(name, storage::FNV1A_OFFSET_BASIS ^ (seed * 0x9e3779b97f4a7c15ull));
+                    return hash ^ (hash >> 32);
+                }
+            }
+
+            class PatternMatcher::PrivateData {
+                public:
+                    // state of the automaton
+                    struct State {
+                        // next state for every character, -1 if no pattern can match any more
+                        std::array<int32_t, 256> next;
+                        bool accepting;
+                    };
+
+                public:
+                    std::vector<std::string> names;
+                    std::vector<std::string> patterns;
+
+                    // perfect hash table, holds indices into names, or -1 for empty slots
+                    std::vector<int32_t> slots;
+                    uint64_t seed;
+
+                    std::vector<State> states;
+                    int32_t startState;
+
+                    // the elements of all patterns, the positions between them are the states of the nondeterministic
+                    // automaton the deterministic one is built from
+                    // every pattern is followed by an accepting position, which has no element
+                    std::vector<PatternElement> elements;
+                    std::vector<bool> acceptingPositions;
+
+                public:
+                    PrivateData() : names(), patterns(), slots(), seed(0), states(), startState(-1), elements(), acceptingPositions() {};
+
+                public:
+                    void add(const std::string& pattern) {
+                        if (containsWildcards(pattern))
+                            patterns.push_back(pattern);
+                        else
+                            names.push_back(pattern);
+                    }
+
+                    void compile() {
+                        buildNameTable();
+                        buildAutomaton();
+                    }
+
+                    void buildNameTable() {
+                        std::set<std::string> uniqueNames(names.begin(), names.end());
+                        names.assign(uniqueNames.begin(), uniqueNames.end());
+
+                        slots.clear();
+
+                        if (names.empty())
+                            return;
+
+                        size_t tableSize = 1;
+                        while (tableSize < names.size() * 2)
+                            tableSize <<= 1;
+
+                        // search for a seed which maps every name to a slot of its own, the table grows if it takes too
+                        // long to find one
+                        for (seed = 0;; seed++) {
+                            if (seed > 0 && seed % 64 == 0)
+                                tableSize <<= 1;
+
+                            slots.assign(tableSize, -1);
+
+                            bool collision = false;
+
+                            for (size_t i = 0; i < names.size() && !collision; i++) {
+                                auto& slot = slots[hashName(names[i], seed) & (tableSize - 1)];
+
+                                if (slot >= 0)
+                                    collision = true;
+                                else
+                                    slot = static_cast<int32_t>(i);
+                            }
+
+                            if (!collision)
+                                return;
+                        }
+                    }
+
+                    // add position and the positions reachable from it without consuming a character
+                    void addPosition(std::set<uint32_t>& positions, uint32_t position) const {
+                        while (positions.insert(position).second && !acceptingPositions[position] && elements[position].star)
+                            position++;
+                    }
+
+                    void buildAutomaton() {
+                        elements.clear();
+                        acceptingPositions.clear();
+                        states.clear();
+                        startState = -1;
+
+                        std::set<uint32_t> startPositions;
+
+                        for (const auto& pattern : patterns) {
+                            std::vector<PatternElement> patternElements;
+
+                            if (!parsePattern(pattern, patternElements))
+                                continue;
+
+                            const auto patternStart = static_cast<uint32_t>(elements.size());
+
+                            for (const auto& element : patternElements) {
+                                elements.push_back(element);
+                                acceptingPositions.push_back(false);
+                            }
+
+                            elements.push_back(PatternElement{false, {}});
+                            acceptingPositions.push_back(true);
+
+                            addPosition(startPositions, patternStart);
+                        }
+
+                        if (startPositions.empty())
+                            return;
+
+                        // subset construction: every state of the automaton corresponds to a set of positions
+                        std::map<std::set<uint32_t>, int32_t> stateIds;
+                        std::vector<std::set<uint32_t>> pendingStates;
+
+                        auto getState = [&](const std::set<uint32_t>& positions) {
+                            if (positions.empty())
+                                return -1;
+
+                            const auto it = stateIds.find(positions);
+
+                            if (it != stateIds.end())
+                                return it->second;
+
+                            const auto id = static_cast<int32_t>(states.size());
+
+                            State state{};
+                            state.next.fill(-1);
+                            state.accepting = false;
+
+                            for (const auto position : positions) {
+                                if (acceptingPositions[position])
+                                    state.accepting = true;
+                            }
+
+                            states.push_back(state);
+                            stateIds[positions] = id;
+                            pendingStates.push_back(positions);
+
+                            return id;
+                        };
+
+                        startState = getState(startPositions);
+
+                        for (size_t stateId = 0; stateId < pendingStates.size(); stateId++) {
+                            const auto positions = pendingStates[stateId];
+
+                            for (size_t c = 0; c < 256; c++) {
+                                std::set<uint32_t> nextPositions;
+
+                                for (const auto position : positions) {
+                                    if (acceptingPositions[position])
+                                        continue;
+
+                                    const auto& element = elements[position];
+
+                                    if (element.star) {
+                                        if (c != '/')
+                                            addPosition(nextPositions, position);
+                                    } else if (element.characters.test(c)) {
+                                        addPosition(nextPositions, position + 1);
+                                    }
+                                }
+
+                                // states may be added in the meantime, which invalidates references into the vector
+                                const auto nextState = getState(nextPositions);
+                                states[stateId].next[c] = nextState;
+                            }
+                        }
+
+                        // the positions are needed during the construction only
+                        elements.clear();
+                        acceptingPositions.clear();
+                    }
+
+                    bool matchesName(const std::string& filename) const {
+                        if (slots.empty())
+                            return false;
+
+                        const auto index = slots[hashName(filename, seed) & (slots.size() - 1)];
+
+                        return index >= 0 && names[index] == filename;
+                    }
+
+                    bool matchesPattern(const std::string& filename) const {
+                        auto state = startState;
+
+                        for (const auto c : filename) {
+                            if (state < 0)
+                                return false;
+
+                            state = states[state].next[static_cast<unsigned char>(c)];
+                        }
+
+                        return state >= 0 && states[state].accepting;
+                    }
+            };
+
+            PatternMatcher::PatternMatcher() {
+                d = new PrivateData();
+            }
+
+            PatternMatcher::PatternMatcher(const std::vector<std::string>& names, const std::vector<std::string>& patterns) {
+                d = new PrivateData();
+
+                d->names = names;
+
+                for (const auto& pattern : patterns)
+                    d->add(pattern);
+
+                d->compile();
+            }
+
+            PatternMatcher::~PatternMatcher() {
+                delete d;
+            }
+
+            void PatternMatcher::addPattern(const std::string& pattern) {
+                d->add(pattern);
+                d->compile();
+            }
+
+            bool PatternMatcher::matches(const std::string& filename) const {
+                return d->matchesName(filename) || d->matchesPattern(filename);
+            }
+
+            bool PatternMatcher::containsWildcards(const std::string& pattern) {
+                return pattern.find_first_of("*?[\\") != std::string::npos;
+            }
+        }
+    }
+}
@@ -0,0 +1,257 @@
+// system headers
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// local headers
+#include "linuxdeploy/core/storage.h"
+
+namespace bf = boost::filesystem;
+
+namespace {
+    const uint64_t XXH_PRIME64_1 = 0x9e3779b185ebca87ULL;
+    const uint64_t XXH_PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+    const uint64_t XXH_PRIME64_3 = 0x165667b19e3779f9ULL;
+    const uint64_t XXH_PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+    const uint64_t XXH_PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+    uint64_t rotl64(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // XXH64 is defined on little endian words
+    uint64_t readLE64(const unsigned char* data) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+
+    uint32_t readLE32(const unsigned char* data) {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap32(value);
+#endif
+        return value;
+    }
+
+    uint64_t xxh64Round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * XXH_PRIME64_2;
+        accumulator = rotl64(accumulator, 31);
+        return accumulator * XXH_PRIME64_1;
+    }
+
+    uint64_t xxh64MergeRound(uint64_t hash, uint64_t accumulator) {
+        hash ^= xxh64Round(0, accumulator);
+        return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+}
+
+namespace linuxdeploy {
+    namespace core {
+        namespace storage {
+            uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+                const auto* bytes = static_cast<const unsigned char*>(data);
+
+                for (size_t i = 0; i < size; i++) {
+                    hash ^= bytes[i];
+                    hash *= 0x100000001b3ULL;
+                }
+
+                return hash;
+            }
+
+            uint64_t fnv1a(const std::string& data, uint64_t hash) {
+                return fnv1a(data.data(), data.size(), hash);
+            }
+
+            Xxh64::Xxh64(uint64_t seed) : accumulators(), seed(seed), totalSize(0), buffer(), bufferSize(0) {
+                accumulators[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+                accumulators[1] = seed + XXH_PRIME64_2;
+                accumulators[2] = seed;
+                accumulators[3] = seed - XXH_PRIME64_1;
+            }
+
+            void Xxh64::update(const void* data, size_t size) {
+                const auto* bytes = static_cast<const unsigned char*>(data);
+
+                totalSize += size;
+
+                // complete a stripe started by a previous call first
+                if (bufferSize > 0) {
+                    const auto count = std::min(size, sizeof(buffer) - bufferSize);
+                    memcpy(buffer + bufferSize, bytes, count);
+                    bufferSize += count;
+                    bytes += count;
+                    size -= count;
+
+                    if (bufferSize < sizeof(buffer))
+                        return;
+
+                    for (int i = 0; i < 4; i++)
+                        accumulators[i] = xxh64Round(accumulators[i], readLE64(buffer + i * 8));
+
+                    bufferSize = 0;
+                }
+
+                while (size >= sizeof(buffer)) {
+                    for (int i = 0; i < 4; i++)
+                        accumulators[i] = xxh64Round(accumulators[i], readLE64(bytes + i * 8));
+
+                    bytes += sizeof(buffer);
+                    size -= sizeof(buffer);
+                }
+
+                memcpy(buffer, bytes, size);
+                bufferSize = size;
+            }
+
+            uint64_t Xxh64::digest() const {
+                uint64_t hash;
+
+                if (totalSize >= sizeof(buffer)) {
+                    hash = rotl64(accumulators[0], 1) + rotl64(accumulators[1], 7) +
+                           rotl64(accumulators[2], 12) + rotl64(accumulators[3], 18);
+
+                    for (const auto accumulator : accumulators)
+                        hash = xxh64MergeRound(hash, accumulator);
+                } else {
+                    hash = seed + XXH_PRIME64_5;
+                }
+
+                hash += totalSize;
+
+                // mix in the bytes which don't fill a complete stripe
+                size_t offset = 0;
+
+                for (; offset + 8 <= bufferSize; offset += 8) {
+                    hash ^= xxh64Round(0, readLE64(buffer + offset));
+                    hash = rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+                }
+
+                if (offset + 4 <= bufferSize) {
+                    hash ^= static_cast<uint64_t>(readLE32(buffer + offset)) * XXH_PRIME64_1;
+                    hash = rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+                    offset += 4;
+                }
+
+                for (; offset < bufferSize; offset++) {
+                    hash ^= buffer[offset] * XXH_PRIME64_5;
+                    hash = rotl64(hash, 11) * XXH_PRIME64_1;
+                }
+
+                hash ^= hash >> 33;
+                hash *= XXH_PRIME64_2;
+                hash ^= hash >> 29;
+                hash *= XXH_PRIME64_3;
+                hash ^= hash >> 32;
+
+                return hash;
+            }
+
+            bool hashFile(const bf::path& path, uint64_t& hash) {
+                auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                if (fd < 0)
+                    return false;
+
+                Xxh64 xxh64;
+                std::vector<char> buffer(64 * 1024);
+
+                while (true) {
+                    auto result = read(fd, buffer.data(), buffer.size());
+
+                    if (result < 0 && errno == EINTR)
+                        continue;
+
+                    if (result < 0) {
+                        close(fd);
+                        return false;
+                    }
+
+                    if (result == 0)
+                        break;
+
+                    xxh64.update(buffer.data(), static_cast<size_t>(result));
+                }
+
+                close(fd);
+
+                hash = xxh64.digest();
+                return true;
+            }
+
+            std::string toHex(uint64_t value) {
+                char buffer[17];
+                snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+                return buffer;
+            }
+
+            std::string describeFile(const bf::path& path) {
+                struct stat statData{};
+
+                if (stat(path.c_str(), &statData) != 0)
+                    return "";
+
+                std::ostringstream oss;
+                oss << statData.st_dev << ":" << statData.st_ino << ":" << statData.st_size << ":"
+                    << statData.st_mtim.tv_sec << "." << statData.st_mtim.tv_nsec;
+                return oss.str();
+            }
+
+            bool isSingleLine(const std::string& value) {
+                return value.find('\n') == std::string::npos;
+            }
+
+            bool writeFileAtomically(const bf::path& path, const std::string& contents) {
+                // the process ID keeps concurrent processes from writing to the same temporary file
+                const auto temporaryPath = path.string() + "." + std::to_string(getpid()) + ".tmp";
+
+                {
+                    std::ofstream ofs(temporaryPath);
+                    ofs << contents;
+
+                    if (!ofs) {
+                        unlink(temporaryPath.c_str());
+                        return false;
+                    }
+                }
+
+                if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+                    unlink(temporaryPath.c_str());
+                    return false;
+                }
+
+                return true;
+            }
+
+            AppDirKeys::AppDirKeys(const bf::path& appDirPath) : appDirPrefix() {
+                appDirPrefix = bf::absolute(appDirPath).lexically_normal().string();
+
+                while (!appDirPrefix.empty() && appDirPrefix.back() == '/')
+                    appDirPrefix.pop_back();
+
+                appDirPrefix += "/";
+            }
+
+            std::string AppDirKeys::getKey(const bf::path& path) const {
+                auto key = bf::absolute(path).lexically_normal().string();
+
+                if (key.compare(0, appDirPrefix.size(), appDirPrefix) == 0)
+                    key.erase(0, appDirPrefix.size());
+
+                return key;
+            }
+        }
+    }
+}
@@ -1,6 +1,7 @@
 // system headers
 #include <glob.h>
 #include <iostream>
+#include <map>
 
 // library headers
 #include <args.hxx>
@@ -10,6 +11,7 @@
 #include "linuxdeploy/core/desktopfile.h"
 #include "linuxdeploy/core/elf.h"
 #include "linuxdeploy/core/log.h"
+#include "linuxdeploy/core/metadatacache.h"
 #include "linuxdeploy/plugin/plugin.h"
 #include "linuxdeploy/util/util.h"
 
@@ -33,6 +35,7 @@ int main(int argc, char** argv) {
     args::ValueFlag<std::string> appName(parser, "app-name", "Application name (used to initialize desktop file and name icons etc.)", {'n', "app-name"});
 
     args::ValueFlagList<std::string> sharedLibraryPaths(parser, "library", "Shared library to deploy", {'l', "lib", "library"});
+    args::ValueFlagList<std::string> excludedLibraryPatterns(parser, "pattern", "Shared library not to deploy as a dependency, in addition to the excludelist (shell wildcards are supported)", {"exclude-library"});
 
     args::ValueFlagList<std::string> executablePaths(parser, "executable", "Executable to deploy", {'e', "executable"});
 
@@ -43,6 +46,18 @@ int main(int argc, char** argv) {
 
     args::ValueFlag<std::string> customAppRunPath(parser, "AppRun path", "Path to custom AppRun script (linuxdeploy will not create a symlink but copy this file instead)", {"custom-apprun"});
 
+    args::ValueFlag<int> jobs(parser, "jobs", "Number of threads used to process files in parallel (default: number of CPU cores)", {'j', "jobs"});
+
+    args::ValueFlag<std::string> linkMode(parser, "mode", "How to put files into the AppDir: auto, reflink, hardlink or copy (default)", {"link-mode"});
+
+    args::ValueFlag<std::string> deduplicate(parser, "mode", "Replace files with identical contents in the AppDir with hardlinks or relative symlinks (hardlink, symlink); symlinks are only created within a directory", {"deduplicate"});
+
+    args::Flag incremental(parser, "", "Record the deployed files in a manifest in the AppDir, and skip files which are up to date when deploying again", {"incremental"});
+    args::Flag resume(parser, "", "Resume an interrupted run with the same arguments, skipping the operations it has completed", {"resume"});
+
+    args::Flag useCache(parser, "", "Cache information about deployed files (e.g., dependencies) in $XDG_CACHE_HOME/linuxdeploy to speed up subsequent runs", {"cache"});
+    args::ValueFlag<std::string> cacheDirectory(parser, "directory", "Cache information about deployed files in the given directory (implies --cache)", {"cache-dir"});
+
     args::Flag listPlugins(parser, "", "Search for plugins, print them to stdout and exit", {"list-plugins"});
     args::ValueFlagList<std::string> inputPlugins(parser, "name", "Input plugins to run (check whether they are available with --list-plugins)", {'p', "plugin"});
     args::ValueFlagList<std::string> outputPlugins(parser, "name", "Output plugins to run (check whether they are available with --list-plugins)", {'o', "output"});
@@ -90,6 +105,66 @@ int main(int argc, char** argv) {
 
     appdir::AppDir appDir(appDirPath.Get());
 
+    if (jobs) {
+        if (jobs.Get() < 1) {
+            ldLog() << LD_ERROR << "--jobs must be at least 1" << std::endl;
+            return 1;
+        }
+
+        appDir.setJobs(static_cast<size_t>(jobs.Get()));
+    }
+
+    if (linkMode) {
+        const std::map<std::string, appdir::LinkMode> linkModes = {
+            {"auto", appdir::LINK_MODE_AUTO},
+            {"reflink", appdir::LINK_MODE_REFLINK},
+            {"hardlink", appdir::LINK_MODE_HARDLINK},
+            {"copy", appdir::LINK_MODE_COPY},
+        };
+
+        auto it = linkModes.find(linkMode.Get());
+
+        if (it == linkModes.end()) {
+            ldLog() << LD_ERROR << "Invalid --link-mode:" << linkMode.Get() << std::endl;
+            return 1;
+        }
+
+        appDir.setLinkMode(it->second);
+    }
+
+    if (incremental)
+        appDir.setIncremental(true);
+
+    if (resume)
+        appDir.setResume(true);
+
+    if (excludedLibraryPatterns) {
+        for (const auto& pattern : excludedLibraryPatterns.Get())
+            appDir.addExcludedLibraryPattern(pattern);
+    }
+
+    appdir::DeduplicationMode deduplicationMode = appdir::DEDUPLICATE_WITH_HARDLINKS;
+
+    if (deduplicate) {
+        if (deduplicate.Get() == "symlink") {
+            deduplicationMode = appdir::DEDUPLICATE_WITH_SYMLINKS;
+        } else if (deduplicate.Get() != "hardlink") {
+            ldLog() << LD_ERROR << "Invalid --deduplicate mode:" << deduplicate.Get() << std::endl;
+            return 1;
+        }
+    }
+
+    if (cacheDirectory) {
+        appDir.setCacheDirectory(cacheDirectory.Get());
+    } else if (useCache) {
+        auto defaultCacheDirectory = metadatacache::MetadataCache::getDefaultDirectory();
+
+        if (defaultCacheDirectory.empty())
+            ldLog() << LD_WARNING << "Could not determine cache directory, not using cache" << std::endl;
+        else
+            appDir.setCacheDirectory(defaultCacheDirectory);
+    }
+
     if (appName) {
         ldLog() << std::endl << "-- Deploying application \"" << LD_NO_SPACE << appName.Get() << LD_NO_SPACE << "\" --" << std::endl;
         appDir.setAppName(appName.Get());
@@ -109,6 +184,27 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // resolve the dependencies of all the libraries and executables up front, which can be done in parallel
+    {
+        std::vector<bf::path> elfFilePaths;
+
+        if (sharedLibraryPaths) {
+            for (const auto& libraryPath : sharedLibraryPaths.Get()) {
+                if (bf::exists(libraryPath))
+                    elfFilePaths.push_back(libraryPath);
+            }
+        }
+
+        if (executablePaths) {
+            for (const auto& executablePath : executablePaths.Get()) {
+                if (bf::exists(executablePath))
+                    elfFilePaths.push_back(executablePath);
+            }
+        }
+
+        appDir.resolveDependencies(elfFilePaths);
+    }
+
     // deploy shared libraries to usr/lib, and deploy their dependencies to usr/lib
     if (sharedLibraryPaths) {
         ldLog() << std::endl << "-- Deploying shared libraries --" << std::endl;
@@ -289,6 +385,15 @@ int main(int argc, char** argv) {
         }
     }
 
+    // deduplication has to be the last step before the AppDir is packaged, as modifying a file afterwards might modify
+    // its duplicates, too
+    if (deduplicate) {
+        ldLog() << std::endl << "-- Deduplicating files in AppDir --" << std::endl;
+
+        if (!appDir.deduplicateFiles(deduplicationMode))
+            return 1;
+    }
+
     if (outputPlugins) {
         for (const auto& pluginName : outputPlugins.Get()) {
             auto it = foundPlugins.find(std::string(pluginName));
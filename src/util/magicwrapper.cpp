@@ -13,15 +13,24 @@ namespace linuxdeploy {
                     magic_t cookie;
 
                 public:
-                    PrivateData() noexcept(false) {
+                    PrivateData() : cookie(nullptr) {};
+
+                    void load() noexcept(false) {
+                        if (cookie != nullptr)
+                            return;
+
                         cookie = magic_open(MAGIC_CHECK | MAGIC_MIME_TYPE | MAGIC_MIME_ENCODING);
 
                         if (cookie == nullptr)
                             throw MagicError("Failed to open magic database: " + std::string(magic_error(cookie)));
 
                         // load magic data from default location
-                        if (magic_load(cookie, nullptr) != 0)
-                            throw MagicError("Failed to load magic data: " + std::string(magic_error(cookie)));
+                        if (magic_load(cookie, nullptr) != 0) {
+                            const std::string error = magic_error(cookie);
+                            magic_close(cookie);
+                            cookie = nullptr;
+                            throw MagicError("Failed to load magic data: " + error);
+                        }
                     }
 
                     ~PrivateData() {
@@ -41,6 +50,8 @@ namespace linuxdeploy {
             }
 
             std::string Magic::fileType(const std::string& path) {
+                d->load();
+
                 const auto* buf = magic_file(d->cookie, path.c_str());
 
                 if (buf == nullptr)
@@ -9,12 +9,13 @@
 namespace linuxdeploy {
     namespace util {
         namespace magic {
-            // thrown by constructors if opening the magic database fails
+            // thrown if opening the magic database fails
             class MagicError : public std::runtime_error {
                 public:
                     explicit MagicError(const std::string& msg) : std::runtime_error(msg) {}
             };
 
+            // the magic database is loaded when the first file type is requested, so creating instances is cheap
             class Magic {
                 private:
                     class PrivateData;
@@ -26,6 +27,7 @@ namespace linuxdeploy {
 
                 public:
                     // returns MIME-style description of <path>
+                    // loads the magic database if necessary
                     std::string fileType(const std::string& path);
             };
         }
@@ -0,0 +1,203 @@
+// system includes
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "threadpool.h"
+
+namespace linuxdeploy {
+    namespace util {
+        namespace threadpool {
+            class ThreadPool::PrivateData {
+                public:
+                    struct TaskQueue {
+                        std::mutex mutex;
+                        std::deque<std::function<void()>> tasks;
+                    };
+
+                    std::vector<std::thread> workers;
+
+                    // every worker has its own queue for the tasks submitted by the tasks it runs
+                    // workers take tasks from the back of their own queues, and steal tasks from the front of the
+                    // other workers' queues when they run out of work
+                    std::vector<std::unique_ptr<TaskQueue>> queues;
+
+                    // tasks submitted by threads which don't belong to the pool, which are started first in, first out,
+                    // so that the order in which they have been submitted is kept (e.g., the largest files first)
+                    TaskQueue sharedQueue;
+
+                    // protects all of the members below
+                    // a worker queue's lock may be acquired while holding this lock, but not vice versa
+                    std::mutex mutex;
+
+                    // signalled when a task has been added, or the pool is shut down
+                    std::condition_variable taskAvailable;
+
+                    // signalled when the last pending task has been completed
+                    std::condition_variable allTasksDone;
+
+                    // number of tasks in the queues
+                    size_t queuedTasks;
+
+                    // number of tasks that have been submitted but not completed yet
+                    size_t pendingTasks;
+
+                    bool shutdown;
+
+                    // pool and queue index of the current thread, if it is a worker thread
+                    static thread_local PrivateData* currentPool;
+                    static thread_local size_t currentIndex;
+
+                public:
+                    PrivateData() : workers(), queues(), sharedQueue(), mutex(), taskAvailable(), allTasksDone(),
+                                    queuedTasks(0), pendingTasks(0), shutdown(false) {};
+
+                public:
+                    void push(std::function<void()> task) {
+                        // tasks submitted by a task are run by the same worker unless they are stolen, which keeps
+                        // related work together
+                        auto& queue = currentPool == this ? *queues[currentIndex] : sharedQueue;
+
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+
+                            {
+                                std::lock_guard<std::mutex> queueLock(queue.mutex);
+                                queue.tasks.push_back(std::move(task));
+                            }
+
+                            queuedTasks++;
+                            pendingTasks++;
+                        }
+
+                        taskAvailable.notify_one();
+                    }
+
+                    bool pop(size_t index, std::function<void()>& task) {
+                        {
+                            auto& queue = *queues[index];
+                            std::lock_guard<std::mutex> lock(queue.mutex);
+
+                            if (!queue.tasks.empty()) {
+                                task = std::move(queue.tasks.back());
+                                queue.tasks.pop_back();
+                                return true;
+                            }
+                        }
+
+                        {
+                            std::lock_guard<std::mutex> lock(sharedQueue.mutex);
+
+                            if (!sharedQueue.tasks.empty()) {
+                                task = std::move(sharedQueue.tasks.front());
+                                sharedQueue.tasks.pop_front();
+                                return true;
+                            }
+                        }
+
+                        for (size_t i = 1; i < queues.size(); i++) {
+                            auto& queue = *queues[(index + i) % queues.size()];
+                            std::lock_guard<std::mutex> lock(queue.mutex);
+
+                            if (!queue.tasks.empty()) {
+                                task = std::move(queue.tasks.front());
+                                queue.tasks.pop_front();
+                                return true;
+                            }
+                        }
+
+                        return false;
+                    }
+
+                    void run(size_t index) {
+                        currentPool = this;
+                        currentIndex = index;
+
+                        while (true) {
+                            std::function<void()> task;
+
+                            if (!pop(index, task)) {
+                                std::unique_lock<std::mutex> lock(mutex);
+
+                                taskAvailable.wait(lock, [this]() { return shutdown || queuedTasks > 0; });
+
+                                if (queuedTasks == 0)
+                                    return;
+
+                                // another worker might take the task first, try again
+                                continue;
+                            }
+
+                            {
+                                std::lock_guard<std::mutex> lock(mutex);
+                                queuedTasks--;
+                            }
+
+                            task();
+
+                            std::lock_guard<std::mutex> lock(mutex);
+
+                            if (--pendingTasks == 0)
+                                allTasksDone.notify_all();
+                        }
+                    }
+            };
+
+            thread_local ThreadPool::PrivateData* ThreadPool::PrivateData::currentPool = nullptr;
+            thread_local size_t ThreadPool::PrivateData::currentIndex = 0;
+
+            ThreadPool::ThreadPool(size_t threadCount) {
+                d = new PrivateData();
+
+                if (threadCount == 0)
+                    threadCount = defaultThreadCount();
+
+                for (size_t i = 0; i < threadCount; i++)
+                    d->queues.emplace_back(new PrivateData::TaskQueue());
+
+                for (size_t i = 0; i < threadCount; i++)
+                    d->workers.emplace_back(&PrivateData::run, d, i);
+            }
+
+            ThreadPool::~ThreadPool() {
+                wait();
+
+                {
+                    std::lock_guard<std::mutex> lock(d->mutex);
+                    d->shutdown = true;
+                }
+
+                d->taskAvailable.notify_all();
+
+                for (auto& worker : d->workers)
+                    worker.join();
+
+                delete d;
+            }
+
+            void ThreadPool::submit(std::function<void()> task) {
+                d->push(std::move(task));
+            }
+
+            void ThreadPool::wait() {
+                std::unique_lock<std::mutex> lock(d->mutex);
+                d->allTasksDone.wait(lock, [this]() { return d->pendingTasks == 0; });
+            }
+
+            size_t ThreadPool::threadCount() const {
+                return d->workers.size();
+            }
+
+            size_t ThreadPool::defaultThreadCount() {
+                auto count = std::thread::hardware_concurrency();
+
+                // hardware_concurrency() may return 0 if the value is not computable
+                return count > 0 ? count : 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// system includes
+#include <cstddef>
+#include <functional>
+
+#pragma once
+
+namespace linuxdeploy {
+    namespace util {
+        namespace threadpool {
+            /*
+             * Fixed size pool of worker threads.
+             *
+             * Tasks submitted by threads which don't belong to the pool are put into a shared queue, and are started in
+             * the order they have been submitted. Tasks may submit further tasks, which are put into a queue of the worker
+             * running them, and are run most recent first, so that related work is kept together. Idle workers steal
+             * tasks from the other workers' queues. Therefore, the order in which the tasks are completed is not defined.
+             *
+             * The tasks must not throw exceptions; errors have to be reported by other means (e.g., by collecting them
+             * in a container protected by a mutex).
+             */
+            class ThreadPool {
+                private:
+                    class PrivateData;
+                    PrivateData *d;
+
+                public:
+                    // start the given number of worker threads
+                    // if threadCount is 0, the number of CPU cores is used
+                    explicit ThreadPool(size_t threadCount = 0);
+
+                    // waits for all submitted tasks to complete
+                    ~ThreadPool();
+
+                public:
+                    // add task to the queue
+                    // may be called from within tasks
+                    void submit(std::function<void()> task);
+
+                    // block until all submitted tasks, including the ones submitted by other tasks, have been completed
+                    // must not be called from within tasks
+                    void wait();
+
+                    // number of worker threads
+                    size_t threadCount() const;
+
+                    // number of threads to use by default (the number of CPU cores, but at least 1)
+                    static size_t defaultThreadCount();
+            };
+        }
+    }
+}